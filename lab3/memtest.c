@@ -1,7 +1,125 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-int main (int argc, char **argv){
+
+#include "pb-alloc.h"
+
+//another allocator does not provide arenas, whose functions are then NULL
+#pragma weak arena_create
+#pragma weak arena_alloc
+#pragma weak arena_alloc_aligned
+#pragma weak arena_reset
+#pragma weak arena_destroy
+#pragma weak pb_mark
+#pragma weak pb_release
+#pragma weak alloc_stats
+
+//the number of checks that failed
+static int failures = 0;
+
+//report one check, and count it if it failed
+static void check (bool ok, const char* what){
+  if(ok){
+    printf("%s works properly\n", what);
+  }
+  else{
+    printf("%s failed\n", what);
+    failures += 1;
+  }
+}
+
+//fill an arena, reset it, and check that it starts over from the same place;
+//then check that a request larger than its reservation, or than what is left of
+//it, fails rather than overrunning it
+static void check_arena (void){
+  if(arena_create == NULL){
+    printf("Arenas are not provided\n");
+    return;
+  }
+  arena_s* arena = arena_create(1 << 20);
+  if(arena == NULL){
+    check(false, "Arena creation");
+    return;
+  }
+  char* first = arena_alloc(arena, 100);
+  char* second = arena_alloc(arena, 100);
+  char* aligned = arena_alloc_aligned(arena, 4096, 10);
+  bool bumped = first != NULL && second >= first + 100 && (uintptr_t)first % 16 == 0 &&
+                aligned != NULL && (uintptr_t)aligned % 4096 == 0;
+  memset(first, 1, 100);
+  memset(second, 2, 100);
+  bumped &= first[99] == 1 && second[0] == 2;
+  check(bumped, "Arena allocation");
+
+  arena_reset(arena);
+  check(arena_alloc(arena, 100) == first, "Arena reset");
+
+  //the reservation is rounded up, but to nowhere near 64 MB
+  bool refused = arena_alloc(arena, 64 << 20) == NULL;
+  size_t blocks = 0;
+  while(arena_alloc(arena, 4096) != NULL && blocks < (64 << 20) / 4096){
+    blocks++;
+  }
+  refused &= blocks > 0 && blocks < (64 << 20) / 4096 && arena_alloc(arena, 4096) == NULL;
+  check(refused, "Overfull arena_alloc");
+
+  arena_destroy(arena);
+  arena_destroy(NULL);
+}
+
+//check that the block at the top of the heap is reused once freed, and grown
+//in place; that rolling back to a mark reuses everything allocated since and
+//restores the bytes in use; and that calloc clears the space so reused
+static void check_top (void){
+  if(pb_mark == NULL){
+    printf("Mark and release are not provided\n");
+    return;
+  }
+  char* top = malloc(100);
+  free(top);
+  char* again = malloc(100);
+  char* grown = realloc(again, 1000);
+  check(again == top && grown == again, "Top-of-heap reuse");
+  free(grown);
+
+  alloc_stats_s before = { .size = sizeof(alloc_stats_s) };
+  alloc_stats_s after = { .size = sizeof(alloc_stats_s) };
+  alloc_stats(&before);
+  pb_mark_s mark = pb_mark();
+  char* first = malloc(500);
+  for(int i = 0; i < 100; i++){
+    malloc(500);
+  }
+  pb_release(mark);
+  alloc_stats(&after);
+  check(malloc(500) == first && after.in_use_bytes == before.in_use_bytes, "Mark and release");
+
+  //dirty a block, roll it back, and take the same space with calloc
+  mark = pb_mark();
+  char* dirty = malloc(4000);
+  memset(dirty, 0xff, 4000);
+  pb_release(mark);
+  char* clean = calloc(1, 4000);
+  bool zero = clean == dirty;
+  for(int i = 0; i < 4000; i++){
+    zero &= clean[i] == 0;
+  }
+
+  //and again, freeing the block at the top instead
+  dirty = malloc(300);
+  memset(dirty, 0xff, 300);
+  free(dirty);
+  clean = calloc(3, 100);
+  zero &= clean == dirty;
+  for(int i = 0; i < 300; i++){
+    zero &= clean[i] == 0;
+  }
+  check(zero, "calloc of reused space");
+}
+
+int main (void){
 
   //Initial memory allocation
   char* x=malloc(24);
@@ -63,4 +181,9 @@ int main (int argc, char **argv){
      printf(" z is not double-word aligned\n");
   }
 
+  printf("\n");
+  check_arena();
+  check_top();
+
+  return failures != 0;
 }
@@ -4,6 +4,44 @@
  *
  * A _pointer-bumping_ heap allocator.  This allocator *does not re-use* freed
  * blocks.  It uses _pointer bumping_ to expand the heap with each allocation.
+ * It bumps through one region at a time; when that fills, it maps another,
+ * twice the size (up to a maximum), recording each in a table of regions, so
+ * the heap grows without reserving a vast range up front.
+ *
+ * The allocator is thread-safe without locking on the common path.  Each thread
+ * claims a _chunk_ of the current region with a single atomic addition, and
+ * then bumps through that chunk privately; only a block too large for a chunk
+ * is claimed from the region directly.  A lock is taken only to map a new
+ * region.
+ *
+ * Although freed blocks are never reused in general, space at the top of the
+ * heap is.  Freeing the block most recently bumped from a thread's chunk (or a
+ * large block at the top of the current region) moves the pointer back over
+ * it, and resizing such a block moves the pointer to fit, without copying.
+ * `pb_mark()` and `pb_release()` roll a thread's allocations back to a saved
+ * point wholesale, so that stack-like phases run in constant memory.
+ *
+ * The same engine is also offered as a set of _arenas_ for memory whose
+ * lifetime is a phase of the program (a request, say).  Each arena bumps
+ * through a reservation of its own, and `arena_reset()` releases everything
+ * allocated from it at once, by moving its pointer back to the start; only the
+ * pages touched past a watermark are returned to the kernel.
+ *
+ * Setting `PB_ALLOC_TRACE` to a file name records every call in that file (see
+ * ../lab4/alloc-trace.h, which bf-alloc shares; lab4/Makefile puts it on the
+ * include path).
+ *
+ * So that the first allocations need not each take a page fault, setting
+ * `PB_ALLOC_PREFAULT` to a number of megabytes (or calling `pb_prefault()`)
+ * has a background thread populate that much of the heap ahead of its top.
+ * `alloc_stats()` reports how much was prefaulted, and estimates how many of
+ * the heap's pages the program touched first itself.
+ *
+ * The heap region is reserved with `MAP_NORESERVE`, so that it commits memory
+ * only as it is touched.  Setting `PB_ALLOC_HUGEPAGES` to `thp` aligns it to
+ * 2 MB and asks for transparent huge pages; setting it to `hugetlb` backs it
+ * with explicit huge pages from the kernel's reserved pool (falling back to
+ * transparent huge pages if the pool is too small).
  **/
 // ==============================================================================
 
@@ -13,6 +51,8 @@
 // INCLUDES
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -21,6 +61,8 @@
 #include <unistd.h>
 #include <sys/mman.h>
 
+#include "alloc-trace.h"
+#include "pb-alloc.h"
 #include "safeio.h"
 // ==============================================================================
 
@@ -40,8 +82,64 @@
 #define MB(size)  (KB(size) * 1024)
 #define GB(size)  (MB(size) * 1024)
 
-/** The virtual address space reserved for the heap. */
-#define HEAP_SIZE GB(2)
+/**
+ * The size of the first heap region, and the most to which later regions
+ * double.
+ */
+#define REGION_SIZE     MB(64)
+#define REGION_SIZE_MAX GB(2)
+
+/** The most regions that the heap may have. */
+#define MAX_REGIONS 1024
+
+/** The size of a huge page, and so the alignment of a region backed by them. */
+#define HUGE_PAGE_SIZE MB(2)
+
+/** The alignment of every block returned by `malloc()`. */
+#define ALIGNMENT 16
+
+/** The amount of the heap that the prefaulting thread populates at a time. */
+#define PREFAULT_STEP MB(2)
+
+/** The most ranges of the heap that may be given to prefaulting threads. */
+#define PREFAULT_RANGES 64
+
+/** The most pages whose residency `pb_unprefaulted_pages()` asks about at a time. */
+#define MINCORE_PAGES 4096
+
+/**
+ * The size of the chunk that a thread claims from the current region to bump
+ * through privately, and the largest block (header and alignment included) to
+ * be bumped from a chunk rather than claimed from the region on its own.
+ */
+#define CHUNK_SIZE      KB(256)
+#define CHUNK_BLOCK_MAX (CHUNK_SIZE / 8)
+
+/** Round an address or size up to a multiple of `ALIGNMENT`. */
+#define ALIGN_UP(n) (((n) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+/**
+ * Given the end of a block, obtain the address of the header of a block placed
+ * right after it, with the default alignment.  A thread's chunk keeps its free
+ * address in this form, so that the block at the top can be recognized.
+ */
+#define HEADER_AFTER(addr) (ALIGN_UP((addr) + (intptr_t)sizeof(header_s)) - (intptr_t)sizeof(header_s))
+
+/**
+ * Is a block of a given size one that was claimed from a region on its own,
+ * rather than bumped from a chunk?  Blocks aligned beyond `ALIGNMENT` may be
+ * claimed on their own even when this says not, but never the reverse.
+ */
+#define IS_LARGE(size) (ALIGN_UP(size) > CHUNK_BLOCK_MAX - ALIGNMENT)
+
+/**
+ * The space at the start of an arena whose pages stay touched when the arena is
+ * reset; the pages past it are returned to the kernel.
+ */
+#define ARENA_WATERMARK MB(4)
+
+/** Is `n` a power of two? */
+#define IS_POWER_OF_TWO(n) ((n) != 0 && ((n) & ((n) - 1)) == 0)
 // ==============================================================================
 
 
@@ -55,6 +153,69 @@ typedef struct header {
   size_t size;
   
 } header_s;
+
+/** A heap region. */
+typedef struct region {
+
+  /** The beginning and end of the region. */
+  intptr_t start_addr;
+  intptr_t end_addr;
+
+  /**
+   * The address of the next byte to be claimed; once the region is full, this
+   * may overshoot its end.
+   */
+  intptr_t free_addr;
+
+} region_s;
+
+/**
+ * A thread's tally of the bytes in the blocks that it has allocated, less those
+ * in the blocks that it has freed (which another thread may have allocated).
+ * Only the thread itself writes to it, and the tallies outlive their threads,
+ * so that their sum is the total in use.
+ */
+typedef struct tally {
+
+  /** The bytes in use, headers included, modulo the size of a `size_t`. */
+  size_t        in_use_bytes;
+
+  /** The next tally in the list of every thread's. */
+  struct tally* next;
+
+} tally_s;
+
+/** A range of the heap given to a prefaulting thread. */
+typedef struct prefault_range {
+
+  /** The beginning and end of the range, on page boundaries. */
+  intptr_t start_addr;
+  intptr_t end_addr;
+
+} prefault_range_s;
+
+/**
+ * An arena, at the start of its own reservation, from which its blocks are
+ * bumped.  Its blocks carry no headers.
+ */
+struct arena {
+
+  /** The beginning of the space for blocks, just past this structure. */
+  intptr_t start_addr;
+
+  /** The address of the next available byte. */
+  intptr_t free_addr;
+
+  /**
+   * The highest that `free_addr` has been since the pages past the watermark
+   * were last returned to the kernel, as of the last reset.
+   */
+  intptr_t dirty_addr;
+
+  /** The end of the reservation. */
+  intptr_t end_addr;
+
+};
 // ==============================================================================
 
 
@@ -62,14 +223,250 @@ typedef struct header {
 // ==============================================================================
 // GLOBALS
 
-/** The address of the next available byte in the heap region. */
-static intptr_t free_addr  = 0;
+/**
+ * The heap regions, in the order mapped; the last is the current one.  An entry
+ * is complete before `num_regions` counts it.
+ */
+static region_s regions[MAX_REGIONS];
+static size_t   num_regions = 0;
+
+/** The lock that serializes initialization and the mapping of new regions. */
+static pthread_mutex_t region_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Every thread's tally of the bytes in use. */
+static tally_s* tallies = NULL;
+
+/**
+ * The beginning of this thread's chunk, the address of the header of the next
+ * block to be bumped from it (before any extra alignment), and the chunk's end.
+ */
+static __thread intptr_t chunk_start_addr __attribute__((tls_model("initial-exec")));
+static __thread intptr_t chunk_free_addr  __attribute__((tls_model("initial-exec")));
+static __thread intptr_t chunk_end_addr   __attribute__((tls_model("initial-exec")));
+
+/**
+ * The highest that `chunk_free_addr` has been before being moved back; the
+ * chunk is untouched, and so reads as zeros, above both.
+ */
+static __thread intptr_t chunk_dirty_addr __attribute__((tls_model("initial-exec")));
+
+/** This thread's tally; `NULL` until it first allocates or frees. */
+static __thread tally_s* tally __attribute__((tls_model("initial-exec")));
+
+/** Is a thread prefaulting the heap? */
+static bool prefaulting = false;
+
+/**
+ * The ranges given to prefaulting threads, in the order given, and the bytes
+ * prefaulted by every such thread in all.  An entry is complete before
+ * `num_prefault_ranges` counts it.
+ */
+static prefault_range_s prefault_ranges[PREFAULT_RANGES];
+static size_t           num_prefault_ranges = 0;
+static size_t           prefaulted_bytes    = 0;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Map a heap region, backed by the kind of page named by `PB_ALLOC_HUGEPAGES`.
+ * Explicit huge pages are committed when mapped, since touching one that the
+ * pool cannot supply would kill the program; if the pool is too small, fall
+ * back to transparent huge pages.  Otherwise, the region commits memory only
+ * as it is touched.  For transparent huge pages, map an extra huge page's
+ * worth, so that the region can be trimmed to start on a huge page boundary.
+ *
+ * \param size The size of the region; a multiple of `HUGE_PAGE_SIZE`.
+ * \return     The region, or `MAP_FAILED` if it could not be mapped.
+ */
+static void* map_region (size_t size) {
+
+  char* pages = getenv("PB_ALLOC_HUGEPAGES");
+  bool  huge  = (pages != NULL && (strcmp(pages, "thp") == 0 || strcmp(pages, "hugetlb") == 0));
+
+  if (huge && strcmp(pages, "hugetlb") == 0) {
+    void* region = mmap(NULL,
+			size,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+			-1,
+			0);
+    if (region != MAP_FAILED) {
+      return region;
+    }
+  }
+
+  size_t slack  = huge ? HUGE_PAGE_SIZE : 0;
+  void*  region = mmap(NULL,
+		       size + slack,
+		       PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		       -1,
+		       0);
+  if (region == MAP_FAILED || !huge) {
+    return region;
+  }
+
+  // Unmap the space before the first huge page boundary and after the region.
+  intptr_t start = ((intptr_t)region + HUGE_PAGE_SIZE - 1) & ~(intptr_t)(HUGE_PAGE_SIZE - 1);
+  if (start > (intptr_t)region) {
+    munmap(region, start - (intptr_t)region);
+  }
+  munmap((void*)(start + size), (intptr_t)region + slack - start);
+  madvise((void*)start, size, MADV_HUGEPAGE);
+
+  return (void*)start;
+
+} // map_region ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Map a new heap region, record it in the table of regions, and make it the
+ * current one, leaving the rest of the previous region unused.  The region lock
+ * must be held.
+ *
+ * \param size The size of the region; a multiple of `HUGE_PAGE_SIZE`.
+ * \return     `true` if the region was added; `false` if there is no room for
+ *             it, in the address space or in the table.
+ */
+static bool add_region (size_t size) {
+
+  if (num_regions == MAX_REGIONS) {
+    return false;
+  }
+  void* heap = map_region(size);
+  if (heap == MAP_FAILED) {
+    return false;
+  }
+
+  regions[num_regions].start_addr = (intptr_t)heap;
+  regions[num_regions].end_addr   = (intptr_t)heap + size;
+  regions[num_regions].free_addr  = (intptr_t)heap;
+  __atomic_store_n(&num_regions, num_regions + 1, __ATOMIC_RELEASE);
+
+  return true;
+
+} // add_region ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Claim space from the current heap region with a single atomic addition.  If
+ * the region is full, map a new one, twice the size (up to the maximum) but at
+ * least large enough, unless another thread has done so first; then try again.
+ *
+ * \param size The number of bytes to claim; a multiple of `ALIGNMENT`.
+ * \return     The address of the space, if successful; 0 if there is no room
+ *             for another region.
+ */
+static intptr_t claim (size_t size) {
+
+  while (true) {
+
+    size_t    count  = __atomic_load_n(&num_regions, __ATOMIC_ACQUIRE);
+    region_s* region = &regions[count - 1];
+    intptr_t  addr   = __atomic_fetch_add(&region->free_addr, size, __ATOMIC_RELAXED);
+    if (addr <= region->end_addr - (intptr_t)size) {
+      return addr;
+    }
+
+    pthread_mutex_lock(&region_lock);
+    bool added = true;
+    if (num_regions == count) {
+      size_t region_size = region->end_addr - region->start_addr;
+      size_t needed      = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+      region_size        = (region_size < REGION_SIZE_MAX) ? 2 * region_size : REGION_SIZE_MAX;
+      added              = add_region((region_size < needed) ? needed : region_size);
+    }
+    pthread_mutex_unlock(&region_lock);
+    if (!added) {
+      return 0;
+    }
+
+  }
+
+} // claim ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find this thread's tally, claiming and listing one if the thread has none.
+ *
+ * \return The tally.
+ */
+static tally_s* thread_tally (void) {
+
+  if (tally == NULL) {
+    tally_s* new_tally = (tally_s*)claim((sizeof(tally_s) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1));
+    if (new_tally == NULL) {
+      ERROR("Could not claim space for a thread's tally");
+    }
+    new_tally->next = __atomic_load_n(&tallies, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&tallies,
+					&new_tally->next,
+					new_tally,
+					true,
+					__ATOMIC_RELEASE,
+					__ATOMIC_RELAXED)) {
+    }
+    tally = new_tally;
+  }
+
+  return tally;
+
+} // thread_tally ()
+// ==============================================================================
+
+
 
-/** The beginning of the heap. */
-static intptr_t start_addr = 0;
+// ==============================================================================
+/**
+ * Add to this thread's tally of the bytes in use.  Only this thread writes to
+ * it, so a plain (if atomic) store suffices.
+ *
+ * \param bytes The number of bytes to add, modulo the size of a `size_t`.
+ */
+static void count_in_use (size_t bytes) {
+
+  tally_s* own = thread_tally();
+  __atomic_store_n(&own->in_use_bytes, own->in_use_bytes + bytes, __ATOMIC_RELAXED);
+
+} // count_in_use ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Before a `fork()`, take the region lock, so that the child does not inherit it
+ * held by a thread that it lacks.
+ */
+static void fork_prepare (void) {
+
+  pthread_mutex_lock(&region_lock);
+
+} // fork_prepare ()
+// ==============================================================================
 
-/** The end of the heap. */
-static intptr_t end_addr   = 0;
+
+
+// ==============================================================================
+/**
+ * After a `fork()`, in both the parent and the child, release the region lock.
+ */
+static void fork_finish (void) {
+
+  pthread_mutex_unlock(&region_lock);
+
+} // fork_finish ()
 // ==============================================================================
 
 
@@ -82,179 +479,1010 @@ static intptr_t end_addr   = 0;
 void init () {
 
   // Only do anything if there is no heap region (i.e., first time called).
-  if (start_addr == 0) {
+  if (__atomic_load_n(&num_regions, __ATOMIC_ACQUIRE) != 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&region_lock);
+  bool first = (num_regions == 0);
+  if (first) {
 
     DEBUG("Trying to initialize");
-    
-    // Allocate virtual address space in which the heap will reside. Make it
-    // un-shared and not backed by any file (_anonymous_ space).  A failure to
-    // map this space is fatal.
-    void* heap = mmap(NULL,
-		      HEAP_SIZE,
-		      PROT_READ | PROT_WRITE,
-		      MAP_PRIVATE | MAP_ANONYMOUS,
-		      -1,
-		      0);
-    if (heap == MAP_FAILED) {
+
+    // Allocate the first region of virtual address space in which the heap
+    // will reside.  A failure to map this space is fatal.
+    if (!add_region(REGION_SIZE)) {
       ERROR("Could not mmap() heap region");
     }
-
-    // Hold onto the boundaries of the heap as a whole.
-    start_addr = (intptr_t)heap;
-    end_addr   = start_addr + HEAP_SIZE;
-    free_addr  = start_addr;
+    pthread_atfork(fork_prepare, fork_finish, fork_finish);
 
     // DEBUG: Emit a message to indicate that this allocator is being called.
     DEBUG("bp-alloc initialized");
 
   }
+  pthread_mutex_unlock(&region_lock);
+
+  // Start tracing and prefaulting only now, since they may themselves allocate.
+  if (first) {
+    trace_start(getenv("PB_ALLOC_TRACE"));
+    char* prefault = getenv("PB_ALLOC_PREFAULT");
+    if (prefault != NULL) {
+      pb_prefault(MB(strtoul(prefault, NULL, 10)));
+    }
+  }
 
 } // init ()
 // ==============================================================================
 
 
+
 // ==============================================================================
 /**
- * Allocate and return `size` bytes of heap space.  Expand into the heap region
- * via _pointer bumping_.
+ * The prefaulting thread: populate its range of the heap a step at a time, with
+ * `MADV_POPULATE_WRITE` where the kernel has it, or else by touching each page
+ * with an atomic addition of zero, which cannot disturb a block that the
+ * program is already using.
  *
- * \param size The number of bytes to allocate.
-
- * \return A pointer to the allocated block, if successful; `NULL` if
- *         unsuccessful.
+ * \param arg The range to populate (a `prefault_range_s*`).
+ * \return    `NULL`.
  */
-void* malloc (size_t size) {
-  //initializae the heap
-  init();
+static void* prefault_pages (void* arg) {
+
+  prefault_range_s* range     = (prefault_range_s*)arg;
+  intptr_t          page_size = PAGE_SIZE;
+  for (intptr_t addr = range->start_addr; addr < range->end_addr; addr += PREFAULT_STEP) {
+
+    intptr_t end = (range->end_addr - addr < (intptr_t)PREFAULT_STEP) ? range->end_addr : addr + (intptr_t)PREFAULT_STEP;
+#if defined (MADV_POPULATE_WRITE)
+    if (madvise((void*)addr, end - addr, MADV_POPULATE_WRITE) != 0)
+#endif
+    {
+      for (intptr_t page = addr; page < end; page += page_size) {
+	__atomic_fetch_add((char*)page, 0, __ATOMIC_RELAXED);
+      }
+    }
+    __atomic_add_fetch(&prefaulted_bytes, end - addr, __ATOMIC_RELAXED);
 
-  //if the number of bytes to allocate is zero, return NULL, as there's nothing to allocate
-  if (size == 0) {
-    return NULL;
   }
-  // initialize the current total size (occupied by the size passed in and its heaer) and pointer to a header block
-  size_t    total_size = size + sizeof(header_s);
-  header_s* header_ptr = (header_s*)free_addr;
-  
-  //make a double word allignment
-  size_t res = (32 - (size_t)free_addr % 16 - sizeof(header_s) % 16) % 16;
-  free_addr += res;
+  __atomic_store_n(&prefaulting, false, __ATOMIC_RELEASE);
 
-  //initalize the pointer to the block region
-  void*     block_ptr  = (void*)(free_addr + sizeof(header_s));
+  return NULL;
 
-  //initialize the new free address
-  intptr_t new_free_addr = free_addr + total_size;
+} // prefault_pages ()
+// ==============================================================================
 
-  //if new free address is greater than the end address (i.e if it doesn't fit into the region) return null
-  if (new_free_addr > end_addr) {
 
-    return NULL;
 
-  } else {
-    // make free adress equal to the new free adress 
-    free_addr = new_free_addr;
+// ==============================================================================
+/**
+ * Start a background thread populating the heap's pages ahead of its top, so
+ * that the allocations to come do not take page faults on first touch.  The
+ * pages are placed (on a NUMA system) near wherever the thread runs; it
+ * inherits the caller's CPU affinity, so a caller bound to a node gets pages
+ * on that node.
+ *
+ * \param bytes The number of bytes to populate; rounded up to whole pages, and
+ *              limited to the rest of the current heap region.
+ * \return      0 if the thread was started; `EBUSY` if another is still
+ *              running; `ENOMEM` if `PREFAULT_RANGES` ranges have been given
+ *              already; otherwise, the error from starting it.
+ */
+int pb_prefault (size_t bytes) {
+
+  init();
 
+  if (__atomic_exchange_n(&prefaulting, true, __ATOMIC_ACQUIRE)) {
+    return EBUSY;
+  }
+  if (num_prefault_ranges == PREFAULT_RANGES) {
+    __atomic_store_n(&prefaulting, false, __ATOMIC_RELEASE);
+    return ENOMEM;
   }
-  //equate the size of the header region to the number of bytes to allocate
-  header_ptr->size = size;
-  //return pointer to a newly allocated block
-  return block_ptr;
 
-} // malloc()
+  intptr_t  page_size = PAGE_SIZE;
+  region_s* region    = &regions[__atomic_load_n(&num_regions, __ATOMIC_ACQUIRE) - 1];
+  intptr_t  start     = __atomic_load_n(&region->free_addr, __ATOMIC_RELAXED) & ~(page_size - 1);
+  intptr_t  end       = region->end_addr;
+  if (start > end) {
+    start = end;
+  }
+  if (bytes < (size_t)(end - start)) {
+    end = (start + bytes + page_size - 1) & ~(page_size - 1);
+  }
+
+  // Record the range before the thread starts on it, so that
+  // pb_unprefaulted_pages() never counts its pages as touched by the program.
+  prefault_range_s* range = &prefault_ranges[num_prefault_ranges];
+  range->start_addr       = start;
+  range->end_addr         = end;
+  __atomic_store_n(&num_prefault_ranges, num_prefault_ranges + 1, __ATOMIC_RELEASE);
+
+  pthread_t prefaulter;
+  int       result = pthread_create(&prefaulter, NULL, prefault_pages, range);
+  if (result != 0) {
+    __atomic_store_n(&prefaulting, false, __ATOMIC_RELEASE);
+    return result;
+  }
+  pthread_detach(prefaulter);
+
+  return 0;
+
+} // pb_prefault ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Deallocate a given block on the heap.  Add the given block (if any) to the
- * free list.
+ * Estimate the page faults that the program has taken in the heap: count the
+ * resident pages of the space claimed from each region that lie outside every
+ * range given to a prefaulting thread, since the program touched those first.
+ * The estimate takes a pass over the whole heap, so it costs time in proportion
+ * to the heap's size.  It misses pages that the program touched in a range
+ * before the prefaulting thread reached them, and it counts a page that was
+ * returned to the kernel and touched again only once.
  *
- * \param ptr A pointer to the block to be deallocated.
+ * \return The number of resident pages that were never prefaulted.
  */
-void free (void* ptr) {
+size_t pb_unprefaulted_pages (void) {
 
-  DEBUG("free(): ", (intptr_t)ptr);
+  init();
 
-} // free()
+  size_t        count     = __atomic_load_n(&num_regions, __ATOMIC_ACQUIRE);
+  size_t        ranges    = __atomic_load_n(&num_prefault_ranges, __ATOMIC_ACQUIRE);
+  intptr_t      page_size = PAGE_SIZE;
+  size_t        touched   = 0;
+  unsigned char residency[MINCORE_PAGES];
+  for (size_t i = 0; i < count; i += 1) {
+    intptr_t top = __atomic_load_n(&regions[i].free_addr, __ATOMIC_RELAXED);
+    top          = (top < regions[i].end_addr) ? top : regions[i].end_addr;
+    for (intptr_t addr = regions[i].start_addr; addr < top; addr += MINCORE_PAGES * page_size) {
+      intptr_t end   = (top - addr < MINCORE_PAGES * page_size) ? top : addr + MINCORE_PAGES * page_size;
+      size_t   pages = (end - addr + page_size - 1) / page_size;
+      if (mincore((void*)addr, end - addr, residency) != 0) {
+	continue;
+      }
+      for (size_t j = 0; j < pages; j += 1) {
+	intptr_t page  = addr + j * page_size;
+	bool     given = false;
+	for (size_t k = 0; k < ranges && !given; k += 1) {
+	  given = (page >= prefault_ranges[k].start_addr && page < prefault_ranges[k].end_addr);
+	}
+	if ((residency[j] & 1) && !given) {
+	  touched += 1;
+	}
+      }
+    }
+  }
+
+  return touched;
+
+} // pb_unprefaulted_pages ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Allocate a block of `nmemb * size` bytes on the heap, zeroing its contents.
+ * Find the current heap region, the only one whose top may move back.
  *
- * \param nmemb The number of elements in the new block.
- * \param size  The size, in bytes, of each of the `nmemb` elements.
- * \return      A pointer to the newly allocated and zeroed block, if successful;
- *              `NULL` if unsuccessful.
+ * \return The region.
  */
-void* calloc (size_t nmemb, size_t size) {
+static region_s* current_region (void) {
+
+  return &regions[__atomic_load_n(&num_regions, __ATOMIC_ACQUIRE) - 1];
+
+} // current_region ()
+// ==============================================================================
+
 
-  // Allocate a block of the requested size.
-  size_t block_size = nmemb * size;
-  void*  block_ptr  = malloc(block_size);
 
-  // If the allocation succeeded, clear the entire block.
-  if (block_ptr != NULL) {
-    memset(block_ptr, 0, block_size);
+// ==============================================================================
+/**
+ * Zero a range of the heap that is about to lie above a region's top again, so
+ * that the region still reads as zeros there.  Its whole pages are returned to
+ * the kernel, and only the partial pages at either end are cleared by hand; if
+ * the pages cannot be returned (as with explicit huge pages), the whole range
+ * is cleared.
+ *
+ * \param start The beginning of the range.
+ * \param end   The end of the range.
+ */
+static void zero_range (intptr_t start, intptr_t end) {
+
+  intptr_t page_size = PAGE_SIZE;
+  intptr_t first     = (start + page_size - 1) & ~(page_size - 1);
+  intptr_t last      = end & ~(page_size - 1);
+  if (first < last && madvise((void*)first, last - first, MADV_DONTNEED) == 0) {
+    memset((void*)start, 0, first - start);
+    memset((void*)last, 0, end - last);
+  } else {
+    memset((void*)start, 0, end - start);
   }
 
-  return block_ptr;
-  
-} // calloc ()
+} // zero_range ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Update the given block at `ptr` to take on the given `size`.  Here, if `size`
- * fits within the given block, then the block is returned unchanged.  If the
- * `size` is an increase for the block, then a new and larger block is
- * allocated, and the data from the old block is copied, the old block freed,
- * and the new block returned.
+ * Is a block the one most recently bumped from this thread's chunk, with only
+ * unused space above it?
  *
- * \param ptr  The block to be assigned a new size.
- * \param size The new size that the block should assume.
- * \return     A pointer to the resultant block, which may be `ptr` itself, or
- *             may be a newly allocated block.
+ * \param header_ptr The header of the block.
+ * \return           `true` if the block is at the top of the chunk; `false`
+ *                   otherwise.
  */
-void* realloc (void* ptr, size_t size) {
+static bool is_chunk_top (header_s* header_ptr) {
 
-  // if the block to be assigned doesn't exist, we'll call  malloc to allocate a new size region for the block
+  intptr_t end_addr = (intptr_t)header_ptr + sizeof(header_s) + header_ptr->size;
+  return ((intptr_t)header_ptr >= chunk_start_addr &&
+	  (intptr_t)header_ptr <  chunk_end_addr   &&
+	  HEADER_AFTER(end_addr) == chunk_free_addr);
 
-  if (ptr == NULL) {
-    return malloc(size);
-  }
+} // is_chunk_top ()
+// ==============================================================================
 
-  // if the pointer is pointing to a block with data in it, i.e with no free space, we'll deallocate the block, and return NULL, so that we can call malloc later
-  if (size == 0) {
-    free(ptr);
-    return NULL;
-  }
 
-  //identify the old block size, from information in its header
-  header_s* old_header = (header_s*)((intptr_t)ptr - sizeof(header_s));
-  size_t    old_size   = old_header->size;
 
-  //if the news size that the block should assume is less than the old header size, return ptr itself (the block to be assigned a new size), because the new size is not an increase
-  if (size <= old_size) {
-    return ptr;
+// ==============================================================================
+/**
+ * Move the top of this thread's chunk, noting how high it had been.
+ *
+ * \param free_addr The new address for the header of the next block.
+ */
+static void move_chunk_top (intptr_t free_addr) {
+
+  if (chunk_dirty_addr < chunk_free_addr) {
+    chunk_dirty_addr = chunk_free_addr;
   }
-  
-  // initialize a new_ptr, pointing a newly allocated region
-  void* new_ptr = malloc(size);
+  chunk_free_addr = free_addr;
 
-  //if new_ptr is not pointing to a null space, i.e if it is poiting to a sepcific region of the size we allocated earlier, copy the size from the old ptr region to a new_ptr region
-    memcpy(new_ptr, ptr, old_size);
-    free(ptr);
- 
-//return new_ptr
-  return new_ptr;
-  
-} // realloc()
+} // move_chunk_top ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Move the top of the current region, if a large block (or a chunk) ends there,
+ * with a compare-and-swap lest another thread claim space in the meantime.  Any
+ * space given back is zeroed first, since it is the caller's to discard.
+ *
+ * \param start   The beginning of the block; it must lie in the current region
+ *                for the top to move.
+ * \param old_top The end of the block, rounded up to `ALIGNMENT`.
+ * \param new_top The new top; a multiple of `ALIGNMENT`.
+ * \return        `true` if the top was at `old_top`, and has moved; `false`
+ *                otherwise.
+ */
+static bool move_region_top (intptr_t start, intptr_t old_top, intptr_t new_top) {
+
+  region_s* region = current_region();
+  if (start < region->start_addr || new_top > region->end_addr ||
+      __atomic_load_n(&region->free_addr, __ATOMIC_RELAXED) != old_top) {
+    return false;
+  }
+  if (new_top < old_top) {
+    zero_range(new_top, old_top);
+  }
+
+  return __atomic_compare_exchange_n(&region->free_addr,
+				     &old_top,
+				     new_top,
+				     false,
+				     __ATOMIC_RELAXED,
+				     __ATOMIC_RELAXED);
+
+} // move_region_top ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, aligned to a multiple of `alignment`.
+ * Expand into this thread's chunk via _pointer bumping_, skipping just enough
+ * bytes that the block after the header is aligned.  If the chunk is too full,
+ * claim a new one, or claim space from the region for a block too large for
+ * any chunk.
+ *
+ * \param alignment The alignment of the block; a power of two, at least
+ *                  `ALIGNMENT`.
+ * \param size      The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if
+ *         unsuccessful.
+ */
+static void* bump (size_t alignment, size_t size) {
+
+  //initialize the heap
+  init();
+
+  //if the number of bytes to allocate is zero, return NULL, as there's nothing to allocate
+  if (size == 0) {
+    return NULL;
+  }
+
+  //a block larger than any region can never fit
+  if (size > REGION_SIZE_MAX) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  //find the first aligned address in the chunk with room for a header before it
+  intptr_t block_addr = (chunk_free_addr + sizeof(header_s) + alignment - 1) & ~(intptr_t)(alignment - 1);
+
+  //if the block doesn't fit into the chunk, claim a new chunk, or, for a block too large for one, space of its own, and return null if there is none
+  if (chunk_free_addr == 0 || block_addr > chunk_end_addr || size > (size_t)(chunk_end_addr - block_addr)) {
+
+    size_t needed = alignment + ALIGN_UP(size);
+    if (needed > CHUNK_BLOCK_MAX) {
+      intptr_t addr = claim(needed);
+      if (addr == 0) {
+	return NULL;
+      }
+      block_addr = (addr + sizeof(header_s) + alignment - 1) & ~(intptr_t)(alignment - 1);
+    } else {
+      intptr_t addr = claim(CHUNK_SIZE);
+      if (addr == 0) {
+	return NULL;
+      }
+      chunk_start_addr = addr;
+      chunk_free_addr  = addr;
+      chunk_dirty_addr = addr;
+      chunk_end_addr   = addr + CHUNK_SIZE;
+      block_addr       = (chunk_free_addr + sizeof(header_s) + alignment - 1) & ~(intptr_t)(alignment - 1);
+      chunk_free_addr  = HEADER_AFTER(block_addr + (intptr_t)size);
+    }
+
+  } else {
+    // make the chunk's free address follow the block
+    chunk_free_addr = HEADER_AFTER(block_addr + (intptr_t)size);
+  }
+
+  //put the header before the block, holding the number of bytes allocated
+  header_s* header_ptr = (header_s*)(block_addr - sizeof(header_s));
+  header_ptr->size     = size;
+  count_in_use(sizeof(header_s) + size);
+  //return pointer to a newly allocated block
+  return (void*)block_addr;
+
+} // bump ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.  Expand into the heap region
+ * via _pointer bumping_.
+ *
+ * \param size The number of bytes to allocate.
+
+ * \return A pointer to the allocated block, if successful; `NULL` if
+ *         unsuccessful.
+ */
+void* malloc (size_t size) {
+
+  void* block_ptr = bump(ALIGNMENT, size);
+  TRACE(TRACE_MALLOC, block_ptr, size, 0);
+
+  return block_ptr;
+
+} // malloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Account for a block that is no longer in use.  Its space is reused only if it
+ * is at the top of this thread's chunk, or is a large block at the top of the
+ * current region; either top then moves back over it.
+ *
+ * \param ptr A pointer to the block.
+ */
+static void retire (void* ptr) {
+
+  header_s* header_ptr = (header_s*)((intptr_t)ptr - sizeof(header_s));
+  size_t    size       = header_ptr->size;
+  count_in_use(-(sizeof(header_s) + size));
+
+  if (is_chunk_top(header_ptr)) {
+    move_chunk_top((intptr_t)header_ptr);
+  } else if (IS_LARGE(size)) {
+    intptr_t start = (intptr_t)ptr - ALIGNMENT;
+    move_region_top(start, ALIGN_UP((intptr_t)ptr + (intptr_t)size), start);
+  }
+
+} // retire ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.  Add the given block (if any) to the
+ * free list.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void free (void* ptr) {
+
+  DEBUG("free(): ", (intptr_t)ptr);
+
+  if (ptr != NULL) {
+    TRACE(TRACE_FREE, ptr, 0, 0);
+    retire(ptr);
+  }
+
+} // free()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block of `nmemb * size` bytes on the heap, zeroed.  Space is reused
+ * only below the highest that this thread's chunk has reached, and a region's
+ * top is moved back only over space zeroed again, so a newly bumped block needs
+ * clearing only where it lies below that point.  Otherwise, it comes straight
+ * from the anonymous mapping, which is zero, and its pages are first touched
+ * only when the program uses them.
+ *
+ * \param nmemb The number of elements in the new block.
+ * \param size  The size, in bytes, of each of the `nmemb` elements.
+ * \return      A pointer to the newly allocated and zeroed block, if successful;
+ *              `NULL` if unsuccessful (with `errno` set if `nmemb * size`
+ *              overflows).
+ */
+void* calloc (size_t nmemb, size_t size) {
+
+  // Refuse a request whose size cannot be represented.
+  size_t block_size;
+  if (__builtin_mul_overflow(nmemb, size, &block_size)) {
+    errno = ENOMEM;
+    TRACE(TRACE_CALLOC, NULL, SIZE_MAX, 0);
+    return NULL;
+  }
+
+  void* block_ptr = bump(ALIGNMENT, block_size);
+  TRACE(TRACE_CALLOC, block_ptr, block_size, 0);
+
+  intptr_t block_addr = (intptr_t)block_ptr;
+  if (block_ptr != NULL && chunk_start_addr <= block_addr && block_addr < chunk_dirty_addr) {
+    intptr_t dirty_end = block_addr + (intptr_t)block_size;
+    memset(block_ptr, 0, ((dirty_end < chunk_dirty_addr) ? dirty_end : chunk_dirty_addr) - block_addr);
+  }
+
+  return block_ptr;
+  
+} // calloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Resize a block in place by moving the top above it, if it is at the top of
+ * this thread's chunk and still fits there, or is a large block at the top of
+ * the current region and stays large.
+ *
+ * \param header_ptr The header of the block.
+ * \param size       The new size of the block.
+ * \return           `true` if the block now has `size` bytes; `false` if it is
+ *                   not at a top, or cannot be resized there.
+ */
+static bool resize_top (header_s* header_ptr, size_t size) {
+
+  size_t   old_size   = header_ptr->size;
+  intptr_t block_addr = (intptr_t)header_ptr + sizeof(header_s);
+  intptr_t end_addr   = block_addr + (intptr_t)size;
+
+  if (is_chunk_top(header_ptr)) {
+    if (IS_LARGE(size) || end_addr > chunk_end_addr) {
+      return false;
+    }
+    move_chunk_top(HEADER_AFTER(end_addr));
+  } else if (!IS_LARGE(old_size) || !IS_LARGE(size) ||
+	     !move_region_top(block_addr - ALIGNMENT,
+			      ALIGN_UP(block_addr + (intptr_t)old_size),
+			      ALIGN_UP(end_addr))) {
+    return false;
+  }
+
+  header_ptr->size = size;
+  count_in_use(size - old_size);
+
+  return true;
+
+} // resize_top ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.  Here, if the
+ * block is at a top, it is resized in place.  Otherwise, if `size` fits within
+ * the given block, then the block is returned unchanged.  If the `size` is an
+ * increase for the block, then a new and larger block is allocated, and the
+ * data from the old block is copied, the old block freed, and the new block
+ * returned.  Nothing is traced.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+static void* resize (void* ptr, size_t size) {
+
+  // if the block to be assigned doesn't exist, we'll call  malloc to allocate a new size region for the block
+
+  if (ptr == NULL) {
+    return bump(ALIGNMENT, size);
+  }
+
+  // if the pointer is pointing to a block with data in it, i.e with no free space, we'll deallocate the block, and return NULL, so that we can call malloc later
+  if (size == 0) {
+    retire(ptr);
+    return NULL;
+  }
+
+  //identify the old block size, from information in its header
+  header_s* old_header = (header_s*)((intptr_t)ptr - sizeof(header_s));
+  size_t    old_size   = old_header->size;
+
+  //if the block is the last one bumped, move the top to fit it, with no copying
+  if (size <= REGION_SIZE_MAX && resize_top(old_header, size)) {
+    return ptr;
+  }
+
+  //if the news size that the block should assume is less than the old header size, return ptr itself (the block to be assigned a new size), because the new size is not an increase
+  if (size <= old_size) {
+    return ptr;
+  }
+  
+  // initialize a new_ptr, pointing a newly allocated region
+  void* new_ptr = bump(ALIGNMENT, size);
+
+  //if new_ptr is not pointing to a null space, i.e if it is poiting to a sepcific region of the size we allocated earlier, copy the size from the old ptr region to a new_ptr region
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+    retire(ptr);
+  }
+ 
+//return new_ptr
+  return new_ptr;
+  
+} // resize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`, moving it if
+ * necessary.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+void* realloc (void* ptr, size_t size) {
+
+  void* new_ptr = resize(ptr, size);
+  TRACE(TRACE_REALLOC, new_ptr, size, ptr);
+
+  return new_ptr;
+
+} // realloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, aligned to a multiple of `alignment`.
+ * Only the bytes needed to reach the next aligned address are skipped.
+ *
+ * \param memptr    Where to store a pointer to the allocated block.
+ * \param alignment The alignment of the block; a power of two multiple of
+ *                  `sizeof(void*)`.
+ * \param size      The number of bytes to allocate.
+ * \return          0 if successful; `EINVAL` if `alignment` is invalid; `ENOMEM`
+ *                  if there is not enough space.
+ */
+int posix_memalign (void** memptr, size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment) || alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+
+  //a zero-byte request yields no block, which is not a failure
+  *memptr = NULL;
+  if (size == 0) {
+    return 0;
+  }
+
+  void* block_ptr = bump((alignment < ALIGNMENT) ? ALIGNMENT : alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  if (block_ptr == NULL) {
+    return ENOMEM;
+  }
+  *memptr = block_ptr;
+
+  return 0;
+
+} // posix_memalign ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, aligned to a multiple of `alignment`.
+ *
+ * \param alignment The alignment of the block; a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful (with `errno` set).
+ */
+void* aligned_alloc (size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  void* block_ptr = bump((alignment < ALIGNMENT) ? ALIGNMENT : alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  if (block_ptr == NULL && size != 0) {
+    errno = ENOMEM;
+  }
+
+  return block_ptr;
+
+} // aligned_alloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The obsolete form of `aligned_alloc()`.
+ *
+ * \param alignment The alignment of the block; a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* memalign (size_t alignment, size_t size) {
+
+  return aligned_alloc(alignment, size);
+
+} // memalign ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, aligned to a page boundary.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* valloc (size_t size) {
+
+  return aligned_alloc(PAGE_SIZE, size);
+
+} // valloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate whole pages of heap space, enough for `size` bytes, aligned to a page
+ * boundary.  As with glibc, a request for 0 bytes gets one page.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* pvalloc (size_t size) {
+
+  size_t page_size = PAGE_SIZE;
+  if (size > REGION_SIZE_MAX) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (size == 0) {
+    size = page_size;
+  }
+
+  return aligned_alloc(page_size, (size + page_size - 1) & ~(page_size - 1));
+
+} // pvalloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Report the number of bytes usable in an allocated block.
+ *
+ * \param ptr A pointer to the block; may be `NULL`.
+ * \return    The block's usable size, or 0 if `ptr` is `NULL`.
+ */
+size_t malloc_usable_size (void* ptr) {
+
+  if (ptr == NULL) {
+    return 0;
+  }
+
+  //the header holds the size of the useful portion of the block
+  header_s* header_ptr = (header_s*)((intptr_t)ptr - sizeof(header_s));
+  return header_ptr->size;
+
+} // malloc_usable_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a snapshot of the heap's use.  Space is reused only at the top of the
+ * heap, so every byte claimed that is not in use (freed blocks, alignment
+ * padding, the unused ends of threads' chunks, and the space left at the top of
+ * earlier regions alike) is wasted.  The snapshot is taken without stopping
+ * other threads, so it is only approximate while they allocate.
+ *
+ * \param stats Where to store the snapshot, its `size` set by the caller.
+ */
+void alloc_stats (alloc_stats_s* stats) {
+
+  init();
+
+  alloc_stats_s snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  size_t count = __atomic_load_n(&num_regions, __ATOMIC_ACQUIRE);
+  for (size_t i = 0; i + 1 < count; i += 1) {
+    snapshot.heap_bytes += regions[i].end_addr - regions[i].start_addr;
+  }
+  intptr_t free_addr = __atomic_load_n(&regions[count - 1].free_addr, __ATOMIC_RELAXED);
+  if (free_addr > regions[count - 1].end_addr) {
+    free_addr = regions[count - 1].end_addr;
+  }
+  snapshot.heap_bytes += free_addr - regions[count - 1].start_addr;
+
+  tally_s* own = __atomic_load_n(&tallies, __ATOMIC_ACQUIRE);
+  for (; own != NULL; own = own->next) {
+    snapshot.in_use_bytes += __atomic_load_n(&own->in_use_bytes, __ATOMIC_RELAXED);
+  }
+  snapshot.wasted_bytes     = snapshot.heap_bytes - snapshot.in_use_bytes;
+  snapshot.policy           = "bump";
+  snapshot.prefaulted_bytes = __atomic_load_n(&prefaulted_bytes, __ATOMIC_RELAXED);
+
+  // Fill in only as much of the caller's snapshot as it has room for.
+  size_t size   = (stats->size < sizeof(snapshot)) ? stats->size : sizeof(snapshot);
+  snapshot.size = size;
+  memcpy(stats, &snapshot, size);
+
+} // alloc_stats ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Print a summary of the heap's use to `stderr`.
+ */
+void malloc_stats (void) {
+
+  alloc_stats_s stats = { .size = sizeof(alloc_stats_s) };
+  alloc_stats(&stats);
+
+  fprintf(stderr, "heap bytes:      %zu\n", stats.heap_bytes);
+  fprintf(stderr, "in use bytes:    %zu\n", stats.in_use_bytes);
+  fprintf(stderr, "wasted bytes:    %zu\n", stats.wasted_bytes);
+  fprintf(stderr, "prefaulted:      %zu\n", stats.prefaulted_bytes);
+
+} // malloc_stats ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Save the point that this thread's allocations have reached, for
+ * `pb_release()` to roll them back to.
+ *
+ * \return The mark.
+ */
+pb_mark_s pb_mark (void) {
+
+  init();
+
+  pb_mark_s mark;
+  mark.owner        = thread_tally();
+  mark.start_addr   = chunk_start_addr;
+  mark.free_addr    = chunk_free_addr;
+  mark.end_addr     = chunk_end_addr;
+  mark.in_use_bytes = ((tally_s*)mark.owner)->in_use_bytes;
+
+  return mark;
+
+} // pb_mark ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Roll this thread's allocations back to a mark, releasing every block that it
+ * has bumped since, and restoring its tally of the bytes in use.  If the thread
+ * has since moved on to another chunk, the marked chunk becomes its chunk again;
+ * the current one is given back to its region if it lies at the top, but any
+ * chunks in between, and any large blocks, remain lost.  A mark taken by another
+ * thread names another thread's chunk, which rolling back to would corrupt, so
+ * it is an error.
+ *
+ * \param mark A mark that this thread took, and has not rolled back past.
+ */
+void pb_release (pb_mark_s mark) {
+
+  tally_s* own = thread_tally();
+  if (mark.owner != own) {
+    ERROR("pb_release(): Mark taken by another thread: ", (intptr_t)mark.owner);
+  }
+
+  if (mark.start_addr == chunk_start_addr) {
+    move_chunk_top(mark.free_addr);
+  } else {
+    if (chunk_start_addr != 0) {
+      move_region_top(chunk_start_addr, chunk_end_addr, chunk_start_addr);
+    }
+    chunk_start_addr = mark.start_addr;
+    chunk_free_addr  = mark.free_addr;
+    chunk_dirty_addr = mark.end_addr;
+    chunk_end_addr   = mark.end_addr;
+  }
+
+  __atomic_store_n(&own->in_use_bytes, mark.in_use_bytes, __ATOMIC_RELAXED);
+
+} // pb_release ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Create an arena, reserving address space for it without committing memory.
+ * The reservation holds the arena's own bookkeeping too, and is backed by the
+ * kind of page named by `PB_ALLOC_HUGEPAGES`, like the heap.
+ *
+ * \param reserve The size of the reservation, in bytes; rounded up to a
+ *                multiple of `HUGE_PAGE_SIZE`.
+ * \return        The arena, if successful; `NULL` if unsuccessful.
+ */
+arena_s* arena_create (size_t reserve) {
+
+  if (reserve == 0 || reserve > PTRDIFF_MAX - HUGE_PAGE_SIZE) {
+    return NULL;
+  }
+  size_t size  = (reserve + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  void*  space = map_region(size);
+  if (space == MAP_FAILED) {
+    return NULL;
+  }
+
+  arena_s* arena    = (arena_s*)space;
+  arena->start_addr = ((intptr_t)space + sizeof(arena_s) + ALIGNMENT - 1) & ~(intptr_t)(ALIGNMENT - 1);
+  arena->free_addr  = arena->start_addr;
+  arena->dirty_addr = arena->start_addr;
+  arena->end_addr   = (intptr_t)space + size;
+
+  return arena;
+
+} // arena_create ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes from an arena, aligned to a multiple of `alignment`,
+ * via _pointer bumping_.
+ *
+ * \param arena     The arena.
+ * \param alignment The alignment of the block; a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful (`alignment` is invalid, or the arena's
+ *                  reservation is full).
+ */
+void* arena_alloc_aligned (arena_s* arena, size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment) || size == 0) {
+    return NULL;
+  }
+
+  intptr_t block_addr = (arena->free_addr + alignment - 1) & ~(intptr_t)(alignment - 1);
+  if (block_addr > arena->end_addr || size > (size_t)(arena->end_addr - block_addr)) {
+    return NULL;
+  }
+  arena->free_addr = block_addr + size;
+
+  return (void*)block_addr;
+
+} // arena_alloc_aligned ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes from an arena, aligned as `malloc()` would align them.
+ *
+ * \param arena The arena.
+ * \param size  The number of bytes to allocate.
+ * \return      A pointer to the allocated block, if successful; `NULL` if
+ *              unsuccessful.
+ */
+void* arena_alloc (arena_s* arena, size_t size) {
+
+  return arena_alloc_aligned(arena, ALIGNMENT, size);
+
+} // arena_alloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Release every block allocated from an arena at once, by moving its pointer
+ * back to the start.  The pages touched past `ARENA_WATERMARK` are returned to
+ * the kernel, so that one unusually large phase does not hold memory forever;
+ * those below it are kept, since the next phase will likely touch them again.
+ *
+ * \param arena The arena.
+ */
+void arena_reset (arena_s* arena) {
+
+  if (arena->dirty_addr < arena->free_addr) {
+    arena->dirty_addr = arena->free_addr;
+  }
+  arena->free_addr = arena->start_addr;
+
+  intptr_t keep_addr = (intptr_t)arena + ARENA_WATERMARK;
+  if (arena->dirty_addr > keep_addr) {
+    madvise((void*)keep_addr, arena->dirty_addr - keep_addr, MADV_DONTNEED);
+    arena->dirty_addr = keep_addr;
+  }
+
+} // arena_reset ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Destroy an arena, unmapping its whole reservation, blocks and all.
+ *
+ * \param arena The arena; may be `NULL`.
+ */
+void arena_destroy (arena_s* arena) {
+
+  if (arena != NULL) {
+    munmap(arena, arena->end_addr - (intptr_t)arena);
+  }
+
+} // arena_destroy ()
 // ==============================================================================
 
 
@@ -0,0 +1,146 @@
+// ==============================================================================
+/**
+ * pb-alloc.h
+ *
+ * The extensions that pb-alloc provides beyond the standard allocation
+ * functions.  A program linked against the allocator (or preloading it) may
+ * declare them through this header; `alloc_stats()` and `malloc_stats()` are
+ * declared in ../lab4/alloc-stats.h, which it includes (lab4/Makefile puts it
+ * on the include path).
+ **/
+// ==============================================================================
+
+
+
+#if !defined (_PB_ALLOC_H)
+#define _PB_ALLOC_H
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "alloc-stats.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/**
+ * A point in a thread's allocations, to which `pb_release()` rolls them back.
+ * Its fields are the allocator's own.
+ */
+typedef struct pb_mark {
+
+  /** The thread that took the mark (its tally, which no other thread gets). */
+  void*    owner;
+
+  /** The thread's chunk, and the address of the next block's header in it. */
+  intptr_t start_addr;
+  intptr_t free_addr;
+  intptr_t end_addr;
+
+  /** The thread's tally of the bytes in use. */
+  size_t   in_use_bytes;
+
+} pb_mark_s;
+
+/**
+ * An arena: a reservation from which blocks are bumped, all of which are
+ * released together.  An arena is not thread-safe, and its blocks must not be
+ * passed to `free()` or `realloc()`.
+ */
+typedef struct arena arena_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FUNCTIONS
+
+/**
+ * Save the point that this thread's allocations have reached.
+ *
+ * \return The mark.
+ */
+pb_mark_s pb_mark (void);
+
+/**
+ * Roll this thread's allocations back to a mark, releasing every block that it
+ * has allocated since at once.
+ *
+ * \param mark A mark that this thread took, and has not rolled back past.
+ */
+void pb_release (pb_mark_s mark);
+
+/**
+ * Start a background thread populating the heap's pages ahead of its top, so
+ * that the allocations to come do not take page faults on first touch.
+ *
+ * \param bytes The number of bytes to populate.
+ * \return      0 if the thread was started; `EBUSY` if another is still
+ *              running; `ENOMEM` if too many ranges have been given already;
+ *              otherwise, the error from starting it.
+ */
+int pb_prefault (size_t bytes);
+
+/**
+ * Estimate the page faults that the program has taken in the heap, as the
+ * number of its resident pages that were never given to a prefaulting thread.
+ * This takes a pass over the whole heap, so it is slow for a large heap.
+ *
+ * \return The number of resident pages that were never prefaulted.
+ */
+size_t pb_unprefaulted_pages (void);
+
+/**
+ * Create an arena, reserving address space for it without committing memory.
+ *
+ * \param reserve The most space that the arena may take, in bytes.
+ * \return        The arena, if successful; `NULL` if unsuccessful.
+ */
+arena_s* arena_create (size_t reserve);
+
+/**
+ * Allocate `size` bytes from an arena, aligned as `malloc()` would align them.
+ *
+ * \param arena The arena.
+ * \param size  The number of bytes to allocate.
+ * \return      A pointer to the block, if successful; `NULL` if unsuccessful.
+ */
+void* arena_alloc (arena_s* arena, size_t size);
+
+/**
+ * Allocate `size` bytes from an arena, aligned to a multiple of `alignment`.
+ *
+ * \param arena     The arena.
+ * \param alignment The alignment of the block; a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* arena_alloc_aligned (arena_s* arena, size_t alignment, size_t size);
+
+/**
+ * Release every block allocated from an arena at once, in constant time.
+ *
+ * \param arena The arena.
+ */
+void arena_reset (arena_s* arena);
+
+/**
+ * Destroy an arena, releasing its reservation.
+ *
+ * \param arena The arena; may be `NULL`.
+ */
+void arena_destroy (arena_s* arena);
+// ==============================================================================
+
+
+
+#endif // _PB_ALLOC_H
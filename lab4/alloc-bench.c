@@ -0,0 +1,605 @@
+// ==============================================================================
+/**
+ * alloc-bench.c
+ *
+ * A suite of multi-threaded allocator microbenchmarks, each run at a range of
+ * thread counts so as to show both throughput and scalability:
+ *
+ *   churn     Each thread repeatedly allocates, and then frees, batches of
+ *             same-sized blocks.
+ *   powerlaw  Each thread repeatedly replaces a random block in its working set
+ *             with one whose size is drawn from a power law.
+ *   prodcon   Threads are paired, one producing blocks and passing them through
+ *             a queue to the other, which frees them.
+ *   larson    Each thread replaces random blocks in its working set, then hands
+ *             the set to a new thread (in the style of the Larson server
+ *             benchmark), so that most blocks are freed by a thread other than
+ *             the one that allocated them.
+ *   realloc   Each thread grows buffers a little at a time with `realloc()`.
+ *
+ * Run it against an allocator with `LD_PRELOAD` (see the Makefile):
+ *
+ *   ./alloc-bench [-t max_threads] [-n operations] [pattern...]
+ *
+ * Threads count up in powers of two to `max_threads` (by default, the number of
+ * processors).  Each thread performs the same number of operations, so ideal
+ * scaling multiplies throughput by the number of threads.
+ *
+ * Against bf-alloc, which reports on its heap through `alloc_stats()`, the
+ * output also names the placement policy in force (see `BF_ALLOC_POLICY`), and
+ * gives the heap's size and fragmentation with the working sets of `powerlaw`
+ * and `larson` live, so that the policies can be weighed against each other.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc-stats.h"
+
+// Another allocator does not provide alloc_stats(), which is then NULL.
+#pragma weak alloc_stats
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The default number of operations per thread for each pattern. */
+#define DEFAULT_OPS   1000000
+
+/** The number of blocks allocated and freed together by `churn`. */
+#define CHURN_BATCH   64
+#define CHURN_SIZE    64
+
+/** The size of each thread's working set in `powerlaw` and `larson`. */
+#define WORKING_SET   1000
+
+/** The number of generations of threads in `larson`. */
+#define GENERATIONS   10
+
+/** The size of the queue between each producer and consumer; a power of two. */
+#define QUEUE_SIZE    1024
+
+/** The largest size that `realloc` grows a buffer to before starting over. */
+#define REALLOC_MAX   (64 * 1024)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A single-producer, single-consumer queue of blocks. */
+typedef struct queue {
+
+  /** The blocks. */
+  void*    slots[QUEUE_SIZE];
+
+  /** The number of blocks ever pushed, and ever popped. */
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t tail __attribute__((aligned(64)));
+
+} queue_s;
+
+/** The state of a worker thread. */
+typedef struct worker {
+
+  /** The thread. */
+  pthread_t thread;
+
+  /** The thread's number, and the number of threads. */
+  size_t    id;
+  size_t    count;
+
+  /** The number of operations to perform. */
+  size_t    ops;
+
+  /** The thread's pseudo-random number generator state. */
+  uint64_t  rng;
+
+  /** For `prodcon`, the queue shared with the partner thread. */
+  queue_s*  queue;
+
+  /** For `larson`, the working set handed from one generation to the next. */
+  void**    blocks;
+
+  /** When the thread started and finished its operations, in nanoseconds. */
+  uint64_t  start;
+  uint64_t  end;
+
+  /**
+   * For `powerlaw` and `larson`, the heap's size and fragmentation with the
+   * working set live, as the allocator reports them.
+   */
+  size_t    heap_bytes;
+  double    fragmentation;
+
+} worker_s;
+
+/** A benchmark pattern. */
+typedef struct pattern {
+
+  /** The pattern's name. */
+  const char* name;
+
+  /** The body of each worker thread. */
+  void*     (*run) (void*);
+
+} pattern_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The barrier at which the workers and the timer start together. */
+static pthread_barrier_t start_barrier;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read the monotonic clock.
+ *
+ * \return The current time, in nanoseconds.
+ */
+static uint64_t now_ns () {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+} // now_ns ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Wait for every worker to be ready, then note the start time.
+ *
+ * \param worker The worker.
+ */
+static void start_worker (worker_s* worker) {
+
+  pthread_barrier_wait(&start_barrier);
+  worker->start = now_ns();
+
+} // start_worker ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Note the heap's size and fragmentation, if the allocator reports them.
+ *
+ * \param worker The worker.
+ */
+static void note_heap (worker_s* worker) {
+
+  if (alloc_stats != NULL) {
+    alloc_stats_s stats = { .size = sizeof(alloc_stats_s) };
+    alloc_stats(&stats);
+    worker->heap_bytes    = stats.heap_bytes;
+    worker->fragmentation = stats.fragmentation;
+  }
+
+} // note_heap ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Draw a pseudo-random number (xorshift64).
+ *
+ * \param state The generator's state.
+ * \return      The number.
+ */
+static uint64_t rng (uint64_t* state) {
+
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+
+} // rng ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Draw a block size from a power law between 16 bytes and 64 KB, so that small
+ * blocks dominate but large ones still occur.
+ *
+ * \param state The generator's state.
+ * \return      The size.
+ */
+static size_t power_law_size (uint64_t* state) {
+
+  double u = (rng(state) >> 11) * (1.0 / 9007199254740992.0) + 1e-12;
+  double s = 16 * pow(u, -1.0 / 1.2);
+  return (s > 64 * 1024) ? 64 * 1024 : (size_t)s;
+
+} // power_law_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block and write to its first byte, as a real program would.
+ *
+ * \param size The size of the block.
+ * \return     The block, or `NULL` if the allocation failed.
+ */
+static void* touch_malloc (size_t size) {
+
+  char* block = malloc(size);
+  if (block != NULL) {
+    *(volatile char*)block = 1;
+  }
+  return block;
+
+} // touch_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** The `churn` pattern. */
+static void* run_churn (void* arg) {
+
+  worker_s* worker = arg;
+  void*     blocks[CHURN_BATCH];
+  start_worker(worker);
+
+  for (size_t i = 0; i < worker->ops; i += 2 * CHURN_BATCH) {
+    for (size_t j = 0; j < CHURN_BATCH; j += 1) {
+      blocks[j] = touch_malloc(CHURN_SIZE);
+    }
+    for (size_t j = 0; j < CHURN_BATCH; j += 1) {
+      free(blocks[j]);
+    }
+  }
+
+  worker->end = now_ns();
+
+  return NULL;
+
+} // run_churn ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** The `powerlaw` pattern. */
+static void* run_powerlaw (void* arg) {
+
+  worker_s* worker = arg;
+  void*     blocks[WORKING_SET] = { NULL };
+  start_worker(worker);
+
+  for (size_t i = 0; i < worker->ops; i += 2) {
+    size_t j  = rng(&worker->rng) % WORKING_SET;
+    free(blocks[j]);
+    blocks[j] = touch_malloc(power_law_size(&worker->rng));
+  }
+  note_heap(worker);
+  for (size_t j = 0; j < WORKING_SET; j += 1) {
+    free(blocks[j]);
+  }
+
+  worker->end = now_ns();
+
+  return NULL;
+
+} // run_powerlaw ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The `prodcon` pattern.  Even-numbered threads produce for the next thread; a
+ * last thread without a partner both produces and consumes.
+ */
+static void* run_prodcon (void* arg) {
+
+  worker_s* worker   = arg;
+  queue_s*  queue    = worker->queue;
+  bool      alone    = (worker->id % 2 == 0 && worker->id + 1 == worker->count);
+  bool      producer = (worker->id % 2 == 0);
+  start_worker(worker);
+
+  for (size_t i = 0; i < worker->ops; i += 1) {
+
+    if (producer) {
+      void* block = touch_malloc(16 + rng(&worker->rng) % 512);
+      while (__atomic_load_n(&queue->head, __ATOMIC_RELAXED) -
+	     __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == QUEUE_SIZE) {
+	sched_yield();
+      }
+      queue->slots[queue->head % QUEUE_SIZE] = block;
+      __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+    }
+
+    if (!producer || alone) {
+      while (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) ==
+	     __atomic_load_n(&queue->tail, __ATOMIC_RELAXED)) {
+	sched_yield();
+      }
+      free(queue->slots[queue->tail % QUEUE_SIZE]);
+      __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+    }
+
+  }
+
+  worker->end = now_ns();
+
+  return NULL;
+
+} // run_prodcon ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** One generation of a `larson` lane: replace random blocks in the set. */
+static void* larson_generation (void* arg) {
+
+  worker_s* worker = arg;
+  size_t    rounds = worker->ops / GENERATIONS / 2;
+
+  for (size_t i = 0; i < rounds; i += 1) {
+    size_t j          = rng(&worker->rng) % WORKING_SET;
+    free(worker->blocks[j]);
+    worker->blocks[j] = touch_malloc(16 + rng(&worker->rng) % 1024);
+  }
+
+  return NULL;
+
+} // larson_generation ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The `larson` pattern.  Each worker runs a lane of generations, each a fresh
+ * thread that inherits the working set of the one before it.
+ */
+static void* run_larson (void* arg) {
+
+  worker_s* worker = arg;
+  void*     blocks[WORKING_SET];
+  for (size_t j = 0; j < WORKING_SET; j += 1) {
+    blocks[j] = touch_malloc(16 + rng(&worker->rng) % 1024);
+  }
+  worker->blocks = blocks;
+  start_worker(worker);
+
+  for (size_t g = 0; g < GENERATIONS; g += 1) {
+    pthread_t generation;
+    if (pthread_create(&generation, NULL, larson_generation, worker) != 0) {
+      larson_generation(worker);
+    } else {
+      pthread_join(generation, NULL);
+    }
+  }
+  note_heap(worker);
+  for (size_t j = 0; j < WORKING_SET; j += 1) {
+    free(blocks[j]);
+  }
+
+  worker->end = now_ns();
+
+  return NULL;
+
+} // run_larson ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** The `realloc` pattern. */
+static void* run_realloc (void* arg) {
+
+  worker_s* worker = arg;
+  char*     buffer = NULL;
+  size_t    size   = 0;
+  start_worker(worker);
+
+  for (size_t i = 0; i < worker->ops; i += 1) {
+    size += 16 + rng(&worker->rng) % 256;
+    if (size > REALLOC_MAX) {
+      free(buffer);
+      buffer = NULL;
+      size   = 16;
+    }
+    char* grown = realloc(buffer, size);
+    if (grown != NULL) {
+      buffer           = grown;
+      buffer[size - 1] = 1;
+    }
+  }
+  free(buffer);
+
+  worker->end = now_ns();
+
+  return NULL;
+
+} // run_realloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** The patterns, in the order in which they run by default. */
+static const pattern_s patterns[] = {
+  { "churn",    run_churn    },
+  { "powerlaw", run_powerlaw },
+  { "prodcon",  run_prodcon  },
+  { "larson",   run_larson   },
+  { "realloc",  run_realloc  },
+};
+#define NUM_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Run a pattern on a number of threads.
+ *
+ * \param pattern       The pattern.
+ * \param count         The number of threads.
+ * \param ops           The number of operations per thread.
+ * \param heap_bytes    Where to store the largest heap size that any worker
+ *                      noted; 0 if none did.
+ * \param fragmentation Where to store the greatest fragmentation that any
+ *                      worker noted.
+ * \return              The throughput, in millions of operations per second.
+ */
+static double run_pattern (const pattern_s* pattern,
+			   size_t           count,
+			   size_t           ops,
+			   size_t*          heap_bytes,
+			   double*          fragmentation) {
+
+  worker_s* workers = calloc(count, sizeof(worker_s));
+  queue_s*  queues  = calloc((count + 1) / 2, sizeof(queue_s));
+  if (workers == NULL || queues == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  pthread_barrier_init(&start_barrier, NULL, count + 1);
+
+  for (size_t i = 0; i < count; i += 1) {
+    workers[i].id    = i;
+    workers[i].count = count;
+    workers[i].ops   = ops;
+    workers[i].rng   = 0x9e3779b97f4a7c15ULL * (i + 1);
+    workers[i].queue = &queues[i / 2];
+    if (pthread_create(&workers[i].thread, NULL, pattern->run, &workers[i]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+
+  // Time from the first worker's start to the last worker's finish.
+  pthread_barrier_wait(&start_barrier);
+  uint64_t start = UINT64_MAX;
+  uint64_t end   = 0;
+  *heap_bytes    = 0;
+  *fragmentation = 0;
+  for (size_t i = 0; i < count; i += 1) {
+    pthread_join(workers[i].thread, NULL);
+    start = (workers[i].start < start) ? workers[i].start : start;
+    end   = (workers[i].end > end) ? workers[i].end : end;
+    if (workers[i].heap_bytes > *heap_bytes) {
+      *heap_bytes = workers[i].heap_bytes;
+    }
+    if (workers[i].fragmentation > *fragmentation) {
+      *fragmentation = workers[i].fragmentation;
+    }
+  }
+
+  pthread_barrier_destroy(&start_barrier);
+  free(queues);
+  free(workers);
+
+  return count * ops / ((end - start) / 1e3);
+
+} // run_pattern ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+int main (int argc, char** argv) {
+
+  size_t max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t ops         = DEFAULT_OPS;
+  int    option;
+  while ((option = getopt(argc, argv, "t:n:")) != -1) {
+    switch (option) {
+    case 't':
+      max_threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      ops = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-t max_threads] [-n operations] [pattern...]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (max_threads < 1) {
+    max_threads = 1;
+  }
+
+  if (alloc_stats != NULL) {
+    alloc_stats_s stats = { .size = sizeof(alloc_stats_s) };
+    alloc_stats(&stats);
+    if (stats.policy != NULL) {
+      printf("policy: %s\n", stats.policy);
+    }
+  }
+  printf("%-10s %8s %12s %10s %10s %8s\n", "pattern", "threads", "Mops/s", "speedup", "heap MB", "frag");
+  for (size_t p = 0; p < NUM_PATTERNS; p += 1) {
+
+    // Run only the patterns named, if any are.
+    bool selected = (optind == argc);
+    for (int i = optind; i < argc; i += 1) {
+      selected |= (strcmp(argv[i], patterns[p].name) == 0);
+    }
+    if (!selected) {
+      continue;
+    }
+
+    double base = 0;
+    for (size_t count = 1; count <= max_threads; count *= 2) {
+      size_t heap_bytes;
+      double fragmentation;
+      double throughput = run_pattern(&patterns[p], count, ops, &heap_bytes, &fragmentation);
+      if (count == 1) {
+	base = throughput;
+      }
+      printf("%-10s %8zu %12.2f %10.2f", patterns[p].name, count, throughput, throughput / base);
+      if (heap_bytes != 0) {
+	printf(" %10.1f %8.3f\n", heap_bytes / 1048576.0, fragmentation);
+      } else {
+	printf(" %10s %8s\n", "-", "-");
+      }
+      fflush(stdout);
+      if (count < max_threads && count * 2 > max_threads) {
+	count = max_threads / 2;
+      }
+    }
+
+  }
+
+  return 0;
+
+} // main ()
+// ==============================================================================
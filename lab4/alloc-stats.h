@@ -0,0 +1,114 @@
+// ==============================================================================
+/**
+ * alloc-stats.h
+ *
+ * The heap snapshot that both allocators report through `alloc_stats()`.  Each
+ * allocator fills in the fields that it tracks and leaves the others zero (or
+ * `NULL`), so a program may read any allocator's snapshot through this one
+ * structure.
+ *
+ * The caller sets the snapshot's `size` to `sizeof(alloc_stats_s)` before the
+ * call.  The allocator writes no more than that, and sets `size` to the number
+ * of bytes that it wrote, so that a program and an allocator built against
+ * different versions of this header agree on the fields that they share.
+ **/
+// ==============================================================================
+
+
+
+#if !defined (_ALLOC_STATS_H)
+#define _ALLOC_STATS_H
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** The number of buckets in the histogram of free block sizes. */
+#define ALLOC_STATS_BUCKETS 48
+
+/**
+ * A snapshot of the heap's use.  All sizes are in bytes, and count each block
+ * whole, header included.  New fields go at the end.
+ */
+typedef struct alloc_stats {
+
+  /**
+   * On the way in, the size of the caller's structure; on the way out, the
+   * number of bytes that the allocator filled in.
+   */
+  size_t size;
+
+  /** The space taken from the heap regions (and slabs) by pointer bumping. */
+  size_t heap_bytes;
+
+  /** The space in allocated blocks within the heap regions. */
+  size_t in_use_bytes;
+
+  /** The space in free blocks, available for reuse. */
+  size_t free_bytes;
+
+  /** The number of free blocks. */
+  size_t free_blocks;
+
+  /**
+   * The space taken from the heap that is neither in use nor available for
+   * reuse: slab metadata and free slab objects, or space left behind by
+   * pointer bumping.
+   */
+  size_t wasted_bytes;
+
+  /** The space in blocks with mappings of their own. */
+  size_t mapped_bytes;
+
+  /** The number of blocks with mappings of their own. */
+  size_t mapped_blocks;
+
+  /** The size of the largest free block. */
+  size_t largest_free;
+
+  /**
+   * The external fragmentation: the fraction of the free space that lies
+   * outside the largest free block, from 0 (none) towards 1.
+   */
+  double fragmentation;
+
+  /** The number of free blocks whose size has `i` as its base-2 logarithm. */
+  size_t free_histogram[ALLOC_STATS_BUCKETS];
+
+  /** The name of the placement policy, such as `best` or `bump`. */
+  const char* policy;
+
+  /** The space populated ahead of the heap's top by a prefaulting thread. */
+  size_t prefaulted_bytes;
+
+} alloc_stats_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FUNCTIONS
+
+/**
+ * Take a snapshot of the heap's use.
+ *
+ * \param stats Where to store the snapshot, its `size` set by the caller.
+ */
+void alloc_stats (alloc_stats_s* stats);
+
+/** Print a summary of the heap's use to `stderr`. */
+void malloc_stats (void);
+// ==============================================================================
+
+
+
+#endif // _ALLOC_STATS_H
@@ -0,0 +1,424 @@
+// ==============================================================================
+/**
+ * alloc-trace.h
+ *
+ * An allocation trace recorder.  When started, every call into the allocator
+ * is logged as a fixed-size binary record.  Records are claimed and published
+ * through a lock-free ring buffer, so the allocating threads never take a lock,
+ * and a background thread drains the ring into the trace file.  A thread that
+ * finds the ring full waits for the background thread, so no record is lost.
+ *
+ * A trace file is a `trace_header_s` followed by `trace_record_s` records, in
+ * the order in which they were claimed.  A program that only reads trace files
+ * should define `TRACE_FORMAT_ONLY` before including this header.
+ **/
+// ==============================================================================
+
+
+
+#if !defined (_ALLOC_TRACE_H)
+#define _ALLOC_TRACE_H
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdint.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The magic string at the start of a trace file, and its format version. */
+#define TRACE_MAGIC   "ALLOCTRC"
+#define TRACE_VERSION 1
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** The allocator calls that are traced. */
+typedef enum trace_op {
+
+  TRACE_MALLOC   = 1,
+  TRACE_FREE     = 2,
+  TRACE_CALLOC   = 3,
+  TRACE_REALLOC  = 4,
+  TRACE_MEMALIGN = 5
+
+} trace_op_e;
+
+/** The header of a trace file. */
+typedef struct trace_header {
+
+  /** `TRACE_MAGIC`, without its terminator. */
+  char     magic[8];
+
+  /** `TRACE_VERSION`. */
+  uint32_t version;
+
+  /** The size of each record that follows. */
+  uint32_t record_size;
+
+} trace_header_s;
+
+/** A record of one allocator call. */
+typedef struct trace_record {
+
+  /** The time of the call, in nanoseconds since tracing started. */
+  uint64_t time;
+
+  /** The block returned (or, for `free()`, passed in); 0 for none. */
+  uint64_t addr;
+
+  /** The number of bytes requested (for `calloc()`, in total). */
+  uint64_t size;
+
+  /** For `realloc()`, the block passed in; for an aligned call, the alignment. */
+  uint64_t arg;
+
+  /** The calling thread, numbered from 1 in the order that threads first call. */
+  uint32_t thread;
+
+  /** The call, as a `trace_op_e`. */
+  uint32_t op;
+
+} trace_record_s;
+// ==============================================================================
+
+
+
+#if !defined (TRACE_FORMAT_ONLY)
+// ==============================================================================
+// INCLUDES
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The number of records that the ring buffer holds; a power of two. */
+#define TRACE_RING_SIZE    (1 << 16)
+
+/** The number of records that the background thread writes at once. */
+#define TRACE_BATCH_SIZE   1024
+
+/** How long the background thread sleeps when the ring is empty. */
+#define TRACE_IDLE_NS      1000000
+
+/**
+ * Record an allocator call, if tracing has been started.  The test is all that
+ * an untraced call pays.
+ */
+#define TRACE(op, addr, size, arg)					\
+  do {									\
+    if (__builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED), 0)) { \
+      trace_record((op), (uintptr_t)(addr), (size), (uintptr_t)(arg));	\
+    }									\
+  } while (0)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/**
+ * A slot in the ring buffer.  Its sequence number tells whose turn it is: the
+ * slot is free for the record at position `p` when it equals `p`, and holds
+ * that record, ready to be written out, when it equals `p + 1`.
+ */
+typedef struct trace_slot {
+
+  /** The slot's sequence number. */
+  uint64_t       seq;
+
+  /** The record. */
+  trace_record_s record;
+
+} trace_slot_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** Has tracing been started (and not stopped)? */
+static bool            trace_enabled = false;
+
+/** The ring buffer. */
+static trace_slot_s*   trace_ring    = NULL;
+
+/** The position of the next record to be claimed. */
+static uint64_t        trace_head    = 0;
+
+/** The position of the next record to be written out. */
+static uint64_t        trace_tail    = 0;
+
+/** The trace file. */
+static int             trace_fd      = -1;
+
+/** The time at which tracing started, in nanoseconds. */
+static uint64_t        trace_epoch   = 0;
+
+/** The number of threads that have been numbered so far. */
+static uint32_t        trace_threads = 0;
+
+/** The lock that serializes draining the ring. */
+static pthread_mutex_t trace_lock    = PTHREAD_MUTEX_INITIALIZER;
+
+/** The records being gathered for the trace file. */
+static trace_record_s  trace_batch[TRACE_BATCH_SIZE];
+
+/** This thread's number, or 0 if it has not yet been numbered. */
+static __thread uint32_t trace_thread __attribute__((tls_model("initial-exec")));
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read the monotonic clock.
+ *
+ * \return The current time, in nanoseconds.
+ */
+static inline uint64_t trace_now (void) {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+} // trace_now ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record an allocator call: claim the next position in the ring, wait for its
+ * slot to be free (only if the ring is full), then fill and publish it.
+ *
+ * \param op   The call.
+ * \param addr The block returned or freed.
+ * \param size The number of bytes requested.
+ * \param arg  The call's extra argument, if any.
+ */
+static void trace_record (trace_op_e op, uint64_t addr, uint64_t size, uint64_t arg) {
+
+  if (trace_thread == 0) {
+    trace_thread = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+  }
+
+  uint64_t      position = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+  trace_slot_s* slot     = &trace_ring[position & (TRACE_RING_SIZE - 1)];
+  while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != position) {
+    sched_yield();
+  }
+
+  slot->record.time   = trace_now() - trace_epoch;
+  slot->record.addr   = addr;
+  slot->record.size   = size;
+  slot->record.arg    = arg;
+  slot->record.thread = trace_thread;
+  slot->record.op     = op;
+  __atomic_store_n(&slot->seq, position + 1, __ATOMIC_RELEASE);
+
+} // trace_record ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write a buffer to the trace file in full, giving up on an error.
+ *
+ * \param buffer The bytes to write.
+ * \param length The number of bytes to write.
+ */
+static void trace_write (const void* buffer, size_t length) {
+
+  while (length > 0) {
+    ssize_t written = write(trace_fd, buffer, length);
+    if (written <= 0) {
+      return;
+    }
+    buffer  = (const char*)buffer + written;
+    length -= written;
+  }
+
+} // trace_write ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write every published record, up to the first that is not yet published, to
+ * the trace file, freeing their slots.
+ *
+ * \return The number of records written.
+ */
+static size_t trace_drain (void) {
+
+  pthread_mutex_lock(&trace_lock);
+
+  size_t total = 0;
+  size_t count = 0;
+  while (true) {
+
+    trace_slot_s* slot = &trace_ring[trace_tail & (TRACE_RING_SIZE - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != trace_tail + 1) {
+      break;
+    }
+    trace_batch[count] = slot->record;
+    __atomic_store_n(&slot->seq, trace_tail + TRACE_RING_SIZE, __ATOMIC_RELEASE);
+    trace_tail += 1;
+    count      += 1;
+
+    if (count == TRACE_BATCH_SIZE) {
+      trace_write(trace_batch, count * sizeof(trace_record_s));
+      total += count;
+      count  = 0;
+    }
+
+  }
+  trace_write(trace_batch, count * sizeof(trace_record_s));
+  total += count;
+
+  pthread_mutex_unlock(&trace_lock);
+
+  return total;
+
+} // trace_drain ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The background thread: drain the ring, sleeping whenever it is empty.
+ *
+ * \param arg Unused.
+ * \return    Never returns.
+ */
+static void* trace_flusher (void* arg) {
+
+  (void)arg;
+  struct timespec idle = { 0, TRACE_IDLE_NS };
+  while (true) {
+    if (trace_drain() == 0) {
+      nanosleep(&idle, NULL);
+    }
+  }
+
+  return NULL;
+
+} // trace_flusher ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Stop tracing in the child after a `fork()`, since the background thread does
+ * not survive into it.
+ */
+static void trace_fork_child (void) {
+
+  __atomic_store_n(&trace_enabled, false, __ATOMIC_RELAXED);
+
+} // trace_fork_child ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Stop tracing as the program exits, writing out every record still waiting in
+ * the ring.
+ */
+__attribute__((destructor))
+static void trace_stop (void) {
+
+  if (__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&trace_enabled, false, __ATOMIC_RELAXED);
+    trace_drain();
+  }
+
+} // trace_stop ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Start tracing into a file, if one is named.  This may be called with the
+ * allocator initialized but its initialization lock held; starting the
+ * background thread may re-enter the allocator.
+ *
+ * \param path The name of the trace file; `NULL` or empty not to trace.
+ */
+static void trace_start (const char* path) {
+
+  if (path == NULL || *path == '\0') {
+    return;
+  }
+
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (trace_fd == -1) {
+    return;
+  }
+  trace_header_s header;
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version     = TRACE_VERSION;
+  header.record_size = sizeof(trace_record_s);
+  trace_write(&header, sizeof(header));
+
+  trace_ring = mmap(NULL,
+		    TRACE_RING_SIZE * sizeof(trace_slot_s),
+		    PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS,
+		    -1,
+		    0);
+  if (trace_ring == MAP_FAILED) {
+    close(trace_fd);
+    return;
+  }
+  for (uint64_t i = 0; i < TRACE_RING_SIZE; i += 1) {
+    trace_ring[i].seq = i;
+  }
+
+  trace_epoch = trace_now();
+  pthread_atfork(NULL, NULL, trace_fork_child);
+  __atomic_store_n(&trace_enabled, true, __ATOMIC_RELEASE);
+
+  pthread_t flusher;
+  if (pthread_create(&flusher, NULL, trace_flusher, NULL) != 0) {
+    __atomic_store_n(&trace_enabled, false, __ATOMIC_RELAXED);
+    return;
+  }
+  pthread_detach(flusher);
+
+} // trace_start ()
+// ==============================================================================
+#endif // TRACE_FORMAT_ONLY
+
+
+
+#endif // _ALLOC_TRACE_H
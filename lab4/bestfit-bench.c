@@ -0,0 +1,138 @@
+// ==============================================================================
+/**
+ * bestfit-bench.c
+ *
+ * A benchmark of best-fit searches among many large free blocks.  It frees `n`
+ * blocks of varied sizes, each pinned in place by a small allocation so that
+ * none can coalesce, and then times repeated `malloc()`/`free()` pairs whose
+ * best fit lies among them.  No request fits any block exactly, so a search
+ * cannot stop early.  Run it against an allocator with `LD_PRELOAD`:
+ *
+ *   gcc -O2 -o bestfit-bench bestfit-bench.c
+ *   LD_PRELOAD=./bf-alloc.so ./bestfit-bench
+ *
+ * To compare the tree of large free blocks against the list scan that it
+ * replaced, build the allocator from the revision before the tree (f3c8117) as
+ * well:
+ *
+ *   git show f3c8117~1:lab4/bf-alloc.c > bf-alloc-list.c
+ *   gcc -O2 -fPIC -shared -fno-builtin -o bf-alloc-list.so bf-alloc-list.c safeio.c -lpthread
+ *   LD_PRELOAD=./bf-alloc-list.so ./bestfit-bench
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACROS AND CONSTANTS
+
+/** The smallest of the large free blocks' sizes. */
+#define BASE_SIZE   (2 * 1024)
+
+/** The spacing between the large free blocks' sizes. */
+#define SIZE_STEP   32
+
+/** The number of distinct large free block sizes. */
+#define NUM_SIZES   512
+
+/**
+ * The size of each pin: small, but too large for an allocator to serve it from
+ * a pool of small objects apart from the blocks that it must pin.
+ */
+#define PIN_SIZE    512
+
+/** The number of timed `malloc()`/`free()` pairs per run. */
+#define ITERATIONS  100000
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the current time in nanoseconds.
+ */
+static double now_ns (void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+
+} // now_ns ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Time best-fit searches among `n` large free blocks.
+ *
+ * \param n The number of large free blocks.
+ * \return  The mean time, in nanoseconds, of a `malloc()`/`free()` pair.
+ */
+static double run (size_t n) {
+
+  void** blocks = malloc(n * sizeof(void*));
+  void** pins   = malloc(n * sizeof(void*));
+  if (blocks == NULL || pins == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  // Allocate the blocks in shuffled size order, each followed by a pin.
+  for (size_t i = 0; i < n; i += 1) {
+    size_t j = (i * 7919) % NUM_SIZES;
+    blocks[i] = malloc(BASE_SIZE + j * SIZE_STEP);
+    pins[i]   = malloc(PIN_SIZE);
+  }
+  for (size_t i = 0; i < n; i += 1) {
+    free(blocks[i]);
+  }
+
+  // Request sizes spread over the whole range, each falling between two block
+  // sizes, and return each block at once.
+  double start = now_ns();
+  for (size_t i = 0; i < ITERATIONS; i += 1) {
+    size_t j = (i * 104729) % NUM_SIZES;
+    char*  p = malloc(BASE_SIZE + j * SIZE_STEP + SIZE_STEP / 2);
+    *(volatile char*)p = 0;
+    free(p);
+  }
+  double elapsed = now_ns() - start;
+
+  for (size_t i = 0; i < n; i += 1) {
+    free(pins[i]);
+  }
+  free(pins);
+  free(blocks);
+
+  return elapsed / ITERATIONS;
+
+} // run ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+int main (int argc, char** argv) {
+
+  size_t max = (argc > 1) ? strtoul(argv[1], NULL, 10) : 64 * 1024;
+
+  printf("%10s %12s\n", "free", "ns/pair");
+  for (size_t n = 1024; n <= max; n *= 2) {
+    printf("%10zu %12.1f\n", n, run(n));
+  }
+
+  return 0;
+
+} // main ()
+// ==============================================================================
@@ -2,10 +2,74 @@
 /**
  * bf-alloc.c
  *
- * A _best-fit_ heap allocator.  This allocator uses a _doubly-linked free list_
- * from which to allocate the best fitting free block.  If the list does not
- * contain any blocks of sufficient size, it uses _pointer bumping_ to expand
- * the heap.
+ * A _best-fit_ heap allocator.  This allocator keeps its small free blocks in
+ * _segregated free lists_ (bins), one per exact size, with a bitmap recording
+ * which bins are non-empty.  Larger free blocks are kept in a balanced search
+ * tree (a _treap_) ordered by size and then by address.  Either way, finding
+ * the best fitting free block takes (near-)constant or logarithmic time.  If
+ * there is no block of sufficient size, it uses _pointer bumping_ to expand the
+ * heap.
+ *
+ * Best fit is only the default placement policy for large free blocks.  Setting
+ * `BF_ALLOC_POLICY` to `first` chooses the lowest-addressed block that fits;
+ * to `next`, the lowest-addressed that fits past the last one chosen; and to
+ * `good` (or `good:<percent>`), the first block met, while searching for the
+ * best fit, that is within a percentage of the request.  For first and next
+ * fit, the tree is ordered by address instead, with each node recording the
+ * largest block in its subtree, so that the search still takes logarithmic
+ * time.
+ *
+ * An allocated block carries a single-word header, packing its size together
+ * with flag bits; the bin links exist only while a block is free.  Free blocks
+ * also carry a _boundary tag_ (a footer holding their size), and every header
+ * records whether the physically preceding block is allocated, so that freeing
+ * a block merges it with its free neighbours in constant time.  A free
+ * block just below the bump pointer is handed back to the unallocated region.
+ *
+ * The heap is divided among several _arenas_ (one per processor, or as many as
+ * `BF_ALLOC_ARENAS` says), each independently locked with its own bins, and
+ * threads are spread across them.  An arena bumps through one region at a time;
+ * when that fills, it maps another, twice the size (up to a maximum), so the
+ * heap grows without reserving a vast range up front.  A table of every region
+ * finds the arena that holds any block.
+ *
+ * Small requests (up to `SLAB_MAX` bytes) never reach the bins.  They are
+ * served from _slabs_: page-sized, page-aligned chunks of a separate slab
+ * space, each dedicated to one size class and packed with objects of that size
+ * that carry no header at all.  A slab keeps its metadata, including a bitmap
+ * of its free objects, at its start, where masking the low bits of an object's
+ * address finds it.  Slabs belong to arenas, under their locks; empty slabs are
+ * pooled for any size class, and their pages returned to the kernel once enough
+ * accumulate.  In front of the arenas, each thread keeps a small,
+ * unsynchronized cache of recently freed small objects, from which it can
+ * allocate without taking any lock.
+ *
+ * A thread that frees a block belonging to another thread's arena does not take
+ * that arena's lock: it pushes the block onto the arena's lock-free queue of
+ * _remote frees_, which the next thread to lock the arena for any reason
+ * drains, all at once, while it holds the lock anyway.
+ *
+ * Requests of at least a (tunable) threshold bypass the arenas altogether: each
+ * gets its own mapping, which is unmapped as soon as the block is freed.
+ *
+ * Physical memory is handed back to the kernel (with `MADV_DONTNEED`) from the
+ * page-aligned interiors of large free blocks and from the unallocated top of
+ * each arena, automatically once they pass a threshold, or on request through
+ * `malloc_trim()`.
+ *
+ * `malloc_batch()` and `free_batch()` allocate and free many blocks at once,
+ * taking an arena's lock once per batch rather than once per block.
+ *
+ * Each arena counts its free blocks as they enter and leave the bins, so that
+ * `alloc_stats()` and `malloc_stats()` can report on the heap's use cheaply.
+ * Setting `BF_ALLOC_TRACE` to a file name records every call in that file (see
+ * alloc-trace.h).
+ *
+ * The arenas' regions are reserved with `MAP_NORESERVE`, so that they commit
+ * memory only as it is touched.  Setting `BF_ALLOC_HUGEPAGES` to `thp` aligns
+ * them to 2 MB and asks for transparent huge pages; setting it to `hugetlb`
+ * backs them with explicit huge pages from the kernel's reserved pool (falling
+ * back to transparent huge pages if the pool is too small).
  **/
 // ==============================================================================
 
@@ -14,8 +78,13 @@
 // ==============================================================================
 // INCLUDES
 
+#define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,6 +92,8 @@
 #include <unistd.h>
 #include <sys/mman.h>
 
+#include "alloc-trace.h"
+#include "bf-alloc.h"
 #include "safeio.h"
 // ==============================================================================
 
@@ -31,22 +102,78 @@
 // ==============================================================================
 // TYPES AND STRUCTURES
 
-/** The header for each allocated object. */
+/**
+ * The header for each block.  An allocated block has only the first word; the
+ * links exist only while the block is free, in what is otherwise the start of
+ * its usable space.
+ */
 typedef struct header {
 
-  /** Pointer to the next header in the list. */
+  /**
+   * The size of the whole block (inclusive of the header itself), a multiple of
+   * `ALIGNMENT`, with the flags `ALLOCATED`, `PREV_ALLOCATED` and `MAPPED`
+   * packed into its low bits.
+   */
+  size_t         size;
+
+  /** Pointer to the next header in the bin. */
   struct header* next;
 
-  /** Pointer to the previous header in the list. */
+  /** Pointer to the previous header in the bin. */
   struct header* prev;
 
-  /** The usable size of the block (exclusive of the header itself). */
-  size_t         size;
+} header_s;
 
-  /** Is the block allocated or free? */
-  bool           allocated;
+/**
+ * The header of a large free block, extended with its place in its arena's
+ * tree of large free blocks.  Its `next` and `prev` links go unused.  The tree
+ * is ordered by size and then address, or, under first and next fit, by
+ * address alone.
+ */
+typedef struct node {
 
-} header_s;
+  /** The block's header. */
+  header_s     header;
+
+  /** The subtree of blocks that come before this one. */
+  struct node* left;
+
+  /** The subtree of blocks that come after this one. */
+  struct node* right;
+
+  /**
+   * In a tree ordered by address, the size of the largest block in this one's
+   * subtree (itself included), by which first and next fit search the tree.
+   */
+  size_t       largest;
+
+} node_s;
+
+/**
+ * The placement policies, which choose among the large free blocks that can
+ * hold a request.
+ */
+typedef enum policy {
+
+  /** The smallest block, and the lowest-addressed among those. */
+  POLICY_BEST,
+
+  /** The lowest-addressed block. */
+  POLICY_FIRST,
+
+  /**
+   * The lowest-addressed block at or above the end of the last one allocated
+   * from the arena, wrapping around to the lowest-addressed block of all.
+   */
+  POLICY_NEXT,
+
+  /**
+   * The first block met, while searching for the best fit, that exceeds the
+   * request by no more than `good_fit_percent` percent.
+   */
+  POLICY_GOOD
+
+} policy_e;
 // ==============================================================================
 
 
@@ -65,320 +192,3074 @@ typedef struct header {
 #define MB(size)  (KB(size) * 1024)
 #define GB(size)  (MB(size) * 1024)
 
-/** The virtual address space reserved for the heap. */
-#define HEAP_SIZE GB(2)
+/**
+ * The size of an arena's first region, and the most to which later regions
+ * double.  A block too large for the largest region gets its own mapping.
+ */
+#define REGION_SIZE     MB(64)
+#define REGION_SIZE_MAX GB(2)
+
+/** The most regions that the heap may have across all arenas. */
+#define MAX_REGIONS 1024
+
+/** The size of a huge page, and so the alignment of a region backed by them. */
+#define HUGE_PAGE_SIZE MB(2)
+
+/**
+ * The default size at and above which a block gets its own mapping.  The
+ * `BF_ALLOC_MMAP_THRESHOLD` environment variable overrides it.
+ */
+#define MMAP_THRESHOLD KB(256)
+
+/**
+ * The default amount of free memory in one place at which its pages are
+ * returned to the kernel.  The `BF_ALLOC_TRIM_THRESHOLD` environment variable
+ * overrides it.
+ */
+#define TRIM_THRESHOLD KB(128)
+
+/**
+ * The default excess, as a percentage of the request, that a good fit may have.
+ * `BF_ALLOC_POLICY=good:<percent>` overrides it.
+ */
+#define GOOD_FIT_PERCENT 10
+
+/**
+ * The most space that `malloc_batch()` carves into blocks at once.  Each run of
+ * blocks is taken from an arena as a single block, and so is contiguous.
+ */
+#define BATCH_RUN_MAX MB(1)
+
+/** The alignment of every block, and the granularity of every block size. */
+#define ALIGNMENT 16
+
+/** Round a requested size up to the next multiple of `ALIGNMENT`. */
+#define ALIGN_SIZE(size) (((size) + ALIGNMENT - 1) & ~((size_t)ALIGNMENT - 1))
+
+/** The space taken by the header of an allocated block. */
+#define HEADER_SIZE sizeof(size_t)
+
+/**
+ * The smallest size of a block: room for a free block's header, links and
+ * footer.
+ */
+#define MIN_BLOCK_SIZE ALIGN_SIZE(sizeof(header_s) + sizeof(size_t))
+
+/** The size of block, header included, that holds a request of `size` bytes. */
+#define REQUEST_TO_SIZE(size) \
+  ((ALIGN_SIZE((size) + HEADER_SIZE) < MIN_BLOCK_SIZE) ? \
+   MIN_BLOCK_SIZE : ALIGN_SIZE((size) + HEADER_SIZE))
+
+/**
+ * The flags in a header's `size` field.  A block is `ALLOCATED` (possibly
+ * `MAPPED` on its own) or free; the physically preceding block is either
+ * `PREV_ALLOCATED` (or absent) or free.
+ */
+#define ALLOCATED      ((size_t)0x1)
+#define PREV_ALLOCATED ((size_t)0x2)
+#define MAPPED         ((size_t)0x4)
+#define FLAGS          (ALLOCATED | PREV_ALLOCATED | MAPPED)
+
+/** Given a pointer to a header, obtain the size of its block. */
+#define SIZE(hp) ((hp)->size & ~FLAGS)
+
+/** Given a pointer to a header, obtain the number of bytes usable in its block. */
+#define USABLE_SIZE(hp) (SIZE(hp) - HEADER_SIZE)
 
 /** Given a pointer to a header, obtain a `void*` pointer to the block itself. */
-#define HEADER_TO_BLOCK(hp) ((void*)((intptr_t)hp + sizeof(header_s)))
+#define HEADER_TO_BLOCK(hp) ((void*)((intptr_t)(hp) + HEADER_SIZE))
 
 /** Given a pointer to a block, obtain a `header_s*` pointer to its header. */
-#define BLOCK_TO_HEADER(bp) ((header_s*)((intptr_t)bp - sizeof(header_s)))
+#define BLOCK_TO_HEADER(bp) ((header_s*)((intptr_t)(bp) - HEADER_SIZE))
+
+/** Given a pointer to a header, obtain the address just past its block. */
+#define BLOCK_END(hp) ((intptr_t)(hp) + SIZE(hp))
+
+/** Given a pointer to a free block's header, obtain a pointer to its footer. */
+#define FOOTER(hp) ((size_t*)(BLOCK_END(hp) - sizeof(size_t)))
+
+/**
+ * Given a pointer to a header whose preceding block is free, obtain a pointer to
+ * that preceding block's header, using the preceding block's footer.
+ */
+#define PREV_HEADER(hp) ((header_s*)((intptr_t)(hp) - *((size_t*)(hp) - 1)))
+
+/**
+ * The offset of a header from a page boundary (at the start of an arena or a
+ * mapping), so that the block itself is aligned.
+ */
+#define HEADER_OFFSET (ALIGNMENT - HEADER_SIZE)
+
+/**
+ * Given a pointer to the header of a block with its own mapping, obtain the
+ * start of the mapping, and its length.  The block fills the mapping but for
+ * `HEADER_OFFSET` bytes at the end, and at the start, the header's offset plus
+ * any padding (less than a page) needed to align the block more strictly.
+ */
+#define MAPPING_START(hp) \
+  ((void*)(((intptr_t)(hp) - HEADER_OFFSET) & ~(intptr_t)(PAGE_SIZE - 1)))
+#define MAPPING_LENGTH(hp) \
+  ((size_t)(BLOCK_END(hp) + HEADER_OFFSET - (intptr_t)MAPPING_START(hp)))
+
+/** Is `n` a power of two? */
+#define IS_POWER_OF_TWO(n) ((n) != 0 && ((n) & ((n) - 1)) == 0)
+
+/**
+ * The bins.  Each of the `NUM_BINS` bins holds free blocks of exactly one size,
+ * from `ALIGNMENT` up to `SMALL_MAX`.  Larger free blocks go into the tree.
+ */
+#define NUM_BINS     64
+#define SMALL_MAX    (NUM_BINS * ALIGNMENT)
+
+/** The number of 64-bit words in the bitmap of non-empty bins. */
+#define BINMAP_WORDS ((NUM_BINS + 63) / 64)
+
+/**
+ * The priority of a tree node, which must be (pseudo-)random for the tree to
+ * stay balanced.  It is derived by hashing the node's address.
+ */
+#define PRIORITY(np) (((uintptr_t)(np) >> 4) * (uintptr_t)0x9e3779b97f4a7c15)
+
+/** Does tree node `a` come before tree node `b` (by size, then address)? */
+#define NODE_BEFORE(a, b) \
+  (SIZE(&(a)->header) < SIZE(&(b)->header) || \
+   (SIZE(&(a)->header) == SIZE(&(b)->header) && (a) < (b)))
+
+/** The most arenas to create, however many processors there are. */
+#define MAX_ARENAS 16
+
+/**
+ * The slabs.  Requests of up to `SLAB_MAX` bytes are rounded up to one of
+ * `SLAB_CLASSES` object sizes, in steps of `ALIGNMENT`, and served from slabs
+ * of `SLAB_SIZE` bytes, each aligned to its size.  A slab's metadata takes the
+ * first `SLAB_HEADER_SIZE` bytes, and its objects the rest.
+ */
+#define SLAB_MAX         256
+#define SLAB_CLASSES     (SLAB_MAX / ALIGNMENT)
+#define SLAB_SIZE        KB(4)
+#define SLAB_HEADER_SIZE ALIGN_SIZE(sizeof(slab_s))
+
+/** The number of 64-bit words in a slab's bitmap of free objects. */
+#define SLAB_MAP_WORDS   (SLAB_SIZE / ALIGNMENT / 64)
+
+/** Given a pointer to a small object, obtain the slab that holds it. */
+#define SLAB_OF(bp) ((slab_s*)((intptr_t)(bp) & ~(intptr_t)(SLAB_SIZE - 1)))
+
+/**
+ * The size of the slab space's first segment, and the most to which later
+ * segments double; and the most segments that it may have.
+ */
+#define SLAB_SEGMENT_SIZE     MB(16)
+#define SLAB_SEGMENT_SIZE_MAX GB(1)
+#define MAX_SLAB_SEGMENTS     64
+
+/**
+ * The thread caches.  Each has one list per slab size class, holding at most
+ * `TCACHE_COUNT` objects; a full list is flushed down to half of that.
+ */
+#define TCACHE_BINS  SLAB_CLASSES
+#define TCACHE_COUNT 64
+
+/**
+ * Given a pointer to a cached object, obtain the link to the next one, and the
+ * key that marks the object as cached (the address of the thread's cache).
+ */
+#define CACHE_NEXT(bp) (((void**)(bp))[0])
+#define CACHE_KEY(bp)  (((void**)(bp))[1])
+
+/** Given a pointer to a block freed remotely, obtain the link to the next one. */
+#define REMOTE_NEXT(bp) (((void**)(bp))[0])
+
+/** The bucket of the free-size histogram that counts blocks of a given size. */
+#define STATS_BUCKET(size) \
+  ((63 - __builtin_clzl(size) < ALLOC_STATS_BUCKETS) ? \
+   63 - __builtin_clzl(size) : ALLOC_STATS_BUCKETS - 1)
 // ==============================================================================
 
 
 // ==============================================================================
-// GLOBALS
+// ARENAS AND THREAD CACHES
+
+/**
+ * The metadata of a slab, at its start.  A slab that has free objects is linked
+ * into its arena's list for its size class; a full one is on no list, and an
+ * empty one may be returned to the pool of empty slabs.
+ */
+typedef struct slab {
+
+  /** The arena that allocates from the slab; its lock protects the slab. */
+  struct arena* arena;
+
+  /** The next slab in the arena's list for the size class. */
+  struct slab*  next;
+
+  /** The previous slab in the arena's list for the size class. */
+  struct slab*  prev;
+
+  /** The size of each object. */
+  uint32_t      object_size;
+
+  /** The number of objects that the slab holds. */
+  uint16_t      capacity;
+
+  /** The number of objects allocated (or cached by a thread). */
+  uint16_t      used;
+
+  /** A bitmap in which bit `i` is set if and only if object `i` is free. */
+  uint64_t      free_map[SLAB_MAP_WORDS];
+
+} slab_s;
+
+/** An arena: an independently locked set of heap regions with its own bins. */
+typedef struct arena {
+
+  /** The lock that protects everything else in the arena. */
+  pthread_mutex_t lock;
+
+  /** The address of the next available byte in the current heap region. */
+  intptr_t        free_addr;
+
+  /**
+   * The highest that `free_addr` has been since the pages above it were last
+   * returned to the kernel; the region above this address is untouched, and so
+   * reads as zeros.
+   */
+  intptr_t        dirty_addr;
 
-/** The address of the next available byte in the heap region. */
-static intptr_t free_addr  = 0;
+  /** The beginning of the current heap region; 0 until one is mapped. */
+  intptr_t        start_addr;
 
-/** The beginning of the heap. */
-static intptr_t start_addr = 0;
+  /**
+   * The end of the space in the current heap region for blocks, short of its
+   * true end by room for the header of a fence that seals it.
+   */
+  intptr_t        end_addr;
 
-/** The end of the heap. */
-static intptr_t end_addr   = 0;
+  /** The size of the current heap region. */
+  size_t          region_size;
 
-/** The head of the free list. */
-static header_s* free_list_head = NULL;
+  /** The space taken by pointer bumping in the arena's earlier regions. */
+  size_t          sealed_bytes;
 
-static header_s* allocated_list_head = NULL;
+  /** The heads of the free lists, one per bin. */
+  header_s*       bins[NUM_BINS];
+
+  /** A bitmap in which bit `i` is set if and only if `bins[i]` is non-empty. */
+  uint64_t        binmap[BINMAP_WORDS];
+
+  /** The root of the tree of large free blocks. */
+  node_s*         tree;
+
+  /** For next fit, the address at which the search for a large block starts. */
+  intptr_t        rover;
+
+  /** The total size of the free blocks. */
+  size_t          free_bytes;
+
+  /** The number of free blocks. */
+  size_t          free_blocks;
+
+  /** The number of free blocks in each bucket of sizes. */
+  size_t          free_histogram[ALLOC_STATS_BUCKETS];
+
+  /** The slabs with free objects, one list per size class. */
+  slab_s*         slabs[SLAB_CLASSES];
+
+  /** The total size of the objects allocated from the arena's slabs. */
+  size_t          slab_bytes;
+
+  /**
+   * The blocks freed by threads that allocate from other arenas, linked through
+   * their first words; pushed without the lock, and drained with it.
+   */
+  void*           remote_frees;
+
+} arena_s;
+
+/** A heap region, and the arena that allocates from it. */
+typedef struct region {
+
+  /** The beginning of the region; 0 until the entry is complete. */
+  intptr_t start_addr;
+
+  /** The end of the region. */
+  intptr_t end_addr;
+
+  /** The arena. */
+  arena_s* arena;
+
+} region_s;
 
 /**
+ * A segment of the slab space, carved into slabs.  Its first pages hold a
+ * bitmap of those of its slabs whose pages have been returned to the kernel.
+ */
+typedef struct slab_segment {
+
+  /** The beginning of the segment; 0 until the entry is complete. */
+  intptr_t  start_addr;
+
+  /** The end of the segment. */
+  intptr_t  end_addr;
+
+  /**
+   * A bitmap in which bit `i` is set if and only if the segment's `i`th slab is
+   * empty and untouched since its pages were returned to the kernel.
+   */
+  uint64_t* clean_map;
+
+} slab_segment_s;
+
+/** The kinds of page that may back the arenas' regions. */
+typedef enum huge_pages {
+
+  /** Ordinary pages. */
+  HUGE_PAGES_NONE,
+
+  /** Transparent huge pages, where the kernel can provide them. */
+  HUGE_PAGES_TRANSPARENT,
+
+  /** Explicit huge pages, taken from the kernel's reserved pool. */
+  HUGE_PAGES_EXPLICIT
+
+} huge_pages_e;
+
+/** A thread's cache of small freed objects, linked through their first word. */
+typedef struct tcache {
+
+  /** The head of each list, one per size class. */
+  void*    heads[TCACHE_BINS];
+
+  /** The length of each list. */
+  uint32_t counts[TCACHE_BINS];
+
+  /** Has the cache been registered to be flushed when the thread exits? */
+  bool     registered;
+
+  /** Has the thread exited, so that the cache must no longer be used? */
+  bool     dead;
+
+} tcache_s;
 // ==============================================================================
 
 
 
 // ==============================================================================
-/*
-  The initialization method.  If this is the first use of the heap, initialize it.
+// GLOBALS
+
+/** The arenas, of which the first `num_arenas` are in use. */
+static arena_s arenas[MAX_ARENAS];
+
+/** The number of arenas in use; 0 until the allocator is initialized. */
+static size_t num_arenas = 0;
+
+/** A counter used to spread threads across the arenas. */
+static size_t next_arena = 0;
+
+/** The regions of every arena, of which the first `num_regions` are claimed. */
+static region_s regions[MAX_REGIONS];
+static size_t   num_regions = 0;
+
+/** The size at and above which a block gets its own mapping. */
+static size_t mmap_threshold = MMAP_THRESHOLD;
+
+/** The amount of free memory in one place at which it is trimmed. */
+static size_t trim_threshold = TRIM_THRESHOLD;
+
+/** The kind of page that backs each arena's region. */
+static huge_pages_e huge_pages = HUGE_PAGES_NONE;
+
+/** The placement policy, and the excess that a good fit may have. */
+static policy_e policy           = POLICY_BEST;
+static size_t   good_fit_percent = GOOD_FIT_PERCENT;
+
+/** Are the trees of large free blocks ordered by address (for first and next fit)? */
+static bool     tree_by_address  = false;
+
+/** The name of each placement policy. */
+static const char* policy_names[] = { "best", "first", "next", "good" };
+
+/** The total size of, and number of, blocks with mappings of their own. */
+static size_t mapped_bytes  = 0;
+static size_t mapped_blocks = 0;
+
+/**
+ * The segments of the slab space, of which the first `num_slab_segments` are
+ * complete.
  */
+static slab_segment_s slab_segments[MAX_SLAB_SEGMENTS];
+static size_t         num_slab_segments = 0;
 
-void init () {
+/** The lock that protects the slab space's state below. */
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
 
-  // Only do anything if there is no heap region (i.e., first time called).
-  if (start_addr == 0) {
+/** The next slab to carve from the current segment, and that segment's end. */
+static intptr_t slab_free_addr = 0;
+static intptr_t slab_end_addr  = 0;
 
-    DEBUG("Trying to initialize");
-    
-    // Allocate virtual address space in which the heap will reside. Make it
-    // un-shared and not backed by any file (_anonymous_ space).  A failure to
-    // map this space is fatal.
-    void* heap = mmap(NULL,
-		      HEAP_SIZE,
-		      PROT_READ | PROT_WRITE,
-		      MAP_PRIVATE | MAP_ANONYMOUS,
-		      -1,
-		      0);
-    if (heap == MAP_FAILED) {
-      ERROR("Could not mmap() heap region");
-    }
-
-    // Hold onto the boundaries of the heap as a whole.
-    start_addr = (intptr_t)heap;
-    end_addr   = start_addr + HEAP_SIZE;
-    free_addr  = start_addr;
+/** The size of the current segment; 0 until one is mapped. */
+static size_t   slab_segment_size = 0;
 
-    // DEBUG: Emit a message to indicate that this allocator is being called.
-    DEBUG("bf-alloc initialized");
+/** The space carved into slabs from every segment. */
+static size_t   slab_space_bytes = 0;
 
-  }
+/**
+ * The pool of empty slabs whose pages are still touched, linked through their
+ * `next` fields, and its length.
+ */
+static slab_s*  slab_pool       = NULL;
+static size_t   slab_pool_count = 0;
 
-} // init ()
+/** The number of empty slabs whose pages have been returned to the kernel. */
+static size_t   slab_clean_count = 0;
+
+/** The lock that serializes initialization. */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The key whose destructor flushes a thread's cache when the thread exits. */
+static pthread_key_t tcache_key;
+
+/** The arena that this thread allocates from. */
+static __thread arena_s* thread_arena __attribute__((tls_model("initial-exec")));
+
+/** This thread's cache of small freed objects. */
+static __thread tcache_s tcache __attribute__((tls_model("initial-exec")));
 // ==============================================================================
 
 
+
 // ==============================================================================
 /**
- * Allocate and return `size` bytes of heap space.  Specifically, search the
- * free list, choosing the _best fit_.  If no such block is available, expand
- * into the heap region via _pointer bumping_.
+ * Map a heap region, backed by the kind of page chosen.
+ * Explicit huge pages are committed when mapped, since touching one that the
+ * pool cannot supply would kill the program; if the pool is too small, fall
+ * back to transparent huge pages.  Otherwise, the region commits memory only
+ * as it is touched.  For transparent huge pages, map an extra huge page's
+ * worth, so that the region can be trimmed to start on a huge page boundary.
  *
- * \param size The number of bytes to allocate.
- * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ * \param size The size of the region; a multiple of `HUGE_PAGE_SIZE`.
+ * \return     The region, or `MAP_FAILED` if it could not be mapped.
  */
-void* malloc (size_t size) {
-  //initialize the heap
-  init();
-  //Special case: if the number of bytes to allocate is 0, return NULL. 
-  if (size == 0) {
-    return NULL;
+static void* map_region (size_t size) {
+
+  if (huge_pages == HUGE_PAGES_EXPLICIT) {
+    void* region = mmap(NULL,
+			size,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+			-1,
+			0);
+    if (region != MAP_FAILED) {
+      return region;
+    }
   }
 
-  //initialize the current ponter, and the best one
-  header_s* current = free_list_head;
-  header_s* best    = NULL;
+  size_t slack  = (huge_pages == HUGE_PAGES_NONE) ? 0 : HUGE_PAGE_SIZE;
+  void*  region = mmap(NULL,
+		       size + slack,
+		       PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		       -1,
+		       0);
+  if (region == MAP_FAILED || slack == 0) {
+    return region;
+  }
 
-  //while we have non-null block, chech for the best one
-  while (current != NULL) {
-    // if current block is allocated return error
-    if (current->allocated) {
-      ERROR("Allocated block on free list", (intptr_t)current);
-    }
-    //if the best one so far is null, and the size is smaller or equal than current size, or if best one so far is not null, and the size is smaller or equal than the size of current block, and the size of the current is smaller or equal than the best size, make best = current
-    if ( (best == NULL && size <= current->size) ||
-	 (best != NULL && size <= current->size && current->size < best->size) ) {
-      best = current;
-    }
-    // if we have the best block and it's size is equal to the size of block, break
-    if (best != NULL && best->size == size) {
-      break;
-    }
-    // move the pointer to the next block
-    current = current->next;
-    
+  // Unmap the space before the first huge page boundary and after the region.
+  intptr_t start = ((intptr_t)region + HUGE_PAGE_SIZE - 1) & ~(intptr_t)(HUGE_PAGE_SIZE - 1);
+  if (start > (intptr_t)region) {
+    munmap(region, start - (intptr_t)region);
   }
-  // initialize the new block pointer
-  void* new_block_ptr = NULL;
-  // if the best one is not null
-  if (best != NULL) {
+  munmap((void*)(start + size), (intptr_t)region + slack - start);
+  madvise((void*)start, size, MADV_HUGEPAGE);
 
-    // if the previous to best block is null, it means best is actually the head of the list
-    if (best->prev == NULL) {
-      free_list_head   = best->next;
-    } else {
-      // point the previous header in the list to the next header
-      best->prev->next = best->next;
-    }
-    //is bext header is not null, point the previous pointerr of the next heder to the previous header
-    if (best->next != NULL) {
-      best->next->prev = best->prev;
-    }
-
-    // deatch the best from any blocks, so no other block has pointer to it
-    best->prev = NULL;
-    best->next = NULL;
-    // indicate that the best is already allocated
-    best->allocated = true;
-    // get the ponter to the new block, from the header
-    new_block_ptr   = HEADER_TO_BLOCK(best);
-    
-  } else {
-    //double word allignment
-    size_t res = (32 - (size_t)free_addr % 16 - sizeof(header_s) % 16) % 16;
-    free_addr += res;
-    // make the header pointer point to the free block address
-    header_s* header_ptr = (header_s*)free_addr;
-    // get the ponter to the new block, from the header
-    new_block_ptr = HEADER_TO_BLOCK(header_ptr);
-
-    // detach header_ptr from other blocks, so that there no other pointers to it
-    header_ptr->next      = NULL;
-    header_ptr->prev      = NULL;
-   
-    // equate the size of the header pointed block to the size
-    header_ptr->size      = size;
-     // indicate that the best is already allocated
-    header_ptr->allocated = true;
-    //increase the size of the block
-    intptr_t new_free_addr = (intptr_t)new_block_ptr + size;
-    // if the new increased address is bigger than the set end address
-    if (new_free_addr > end_addr) {
-      //double word allignment
-      free_addr -= res;
-      
-      return NULL;
+  return (void*)start;
 
-    } else {
-      // make the size of free address be equal to the new increased address
-      free_addr = new_free_addr;
+} // map_region ()
+// ==============================================================================
 
-    }
 
-  }
 
-  // adding to allocated list
-  header_s* header_ptr = BLOCK_TO_HEADER(new_block_ptr);
+// ==============================================================================
+/**
+ * Map a new heap region for an arena, record it in the table of regions, and
+ * make it the arena's current region.  The arena must be locked.
+ *
+ * \param arena The arena.
+ * \param size  The size of the region; a multiple of `HUGE_PAGE_SIZE`.
+ * \return      `true` if the region was added; `false` if there is no room for
+ *              it, in the address space or in the table.
+ */
+static bool arena_add_region (arena_s* arena, size_t size) {
 
-  //allocated_list_head
-  header_ptr->next = allocated_list_head;
-  //if the header of allocated list is not null, i.e it it is pointing to some block
-  if(allocated_list_head != NULL){
-    //make header point to the allocated list header
-    allocated_list_head->prev = header_ptr;
+  void* heap = map_region(size);
+  if (heap == MAP_FAILED) {
+    return false;
+  }
+  size_t index = __atomic_fetch_add(&num_regions, 1, __ATOMIC_RELAXED);
+  if (index >= MAX_REGIONS) {
+    munmap(heap, size);
+    return false;
   }
-  allocated_list_head = header_ptr;
 
-  return new_block_ptr;
+  // Publish the region, completing its entry last.
+  regions[index].end_addr = (intptr_t)heap + size;
+  regions[index].arena    = arena;
+  __atomic_store_n(&regions[index].start_addr, (intptr_t)heap, __ATOMIC_RELEASE);
 
-} // malloc()
+  // The first header is offset so that its block is aligned.
+  arena->free_addr   = (intptr_t)heap + HEADER_OFFSET;
+  arena->dirty_addr  = (intptr_t)heap;
+  arena->end_addr    = (intptr_t)heap + size - HEADER_SIZE;
+  arena->region_size = size;
+  __atomic_store_n(&arena->start_addr, (intptr_t)heap, __ATOMIC_RELEASE);
+
+  return true;
+
+} // arena_add_region ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Deallocate a given block on the heap.  Add the given block (if any) to the
- * free list.
+ * Map an arena's first heap region, if it has none yet.  A failure to map it is
+ * fatal.  The arena must be locked.
  *
- * \param ptr A pointer to the block to be deallocated.
+ * \param arena The arena to set up.
  */
-void free (void* ptr) {
-  // special case if we have to free up the no-memory space
-  if (ptr == NULL) {
+static void arena_init (arena_s* arena) {
+
+  if (arena->start_addr != 0) {
     return;
   }
 
-  // get the pointer to the block from its header
-  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
-  // if the block we get isn't allocated return error
-  if (!header_ptr->allocated) {
-    ERROR("Double-free: ", (intptr_t)header_ptr);
-  }
-  //if there is a block after our current one
-  if(header_ptr->next != NULL){
-    // make the next block previous pointer point to the block before our current one
-    header_ptr->next->prev = header_ptr->prev;   
-  }
-  // if there exist a block before our current one
-  if(header_ptr->prev != NULL){
-    // make the next pointer of the previous block, point to the next block after our current one
-     header_ptr->prev->next = header_ptr->next;
-  }
-  else{
-    // make the next block the head of the allocated list
-    allocated_list_head = header_ptr->next; 
+  if (!arena_add_region(arena, REGION_SIZE)) {
+    ERROR("Could not mmap() heap region");
   }
 
-  // make the header point to the next block, which is free_list_head
-  header_ptr->next = free_list_head;
-  // make the free_list_head the new header
-  free_list_head   = header_ptr;
-  // make the header_ptr previous pointer equal to null (because it's the header) 
-  header_ptr->prev = NULL;
-  // if the next block after the header is not null
-  if (header_ptr->next != NULL) {
-    // make the next block's previous pointer point to the header
-    header_ptr->next->prev = header_ptr;
+} // arena_init ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Lock every arena, and then the slab space, so that a `fork()` cannot copy
+ * either mid-operation.
+ */
+static void fork_prepare () {
+
+  for (size_t i = 0; i < num_arenas; i += 1) {
+    pthread_mutex_lock(&arenas[i].lock);
   }
-  // indicate that the block is not allocated (i.e freed)
-  header_ptr->allocated = false;
+  pthread_mutex_lock(&slab_lock);
 
-} // free()
+} // fork_prepare ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Allocate a block of `nmemb * size` bytes on the heap, zeroing its contents.
- *
- * \param nmemb The number of elements in the new block.
- * \param size  The size, in bytes, of each of the `nmemb` elements.
- * \return      A pointer to the newly allocated and zeroed block, if successful;
- *              `NULL` if unsuccessful.
+ * Unlock the slab space and every arena after a `fork()`, in both the parent and
+ * the child.
  */
-void* calloc (size_t nmemb, size_t size) {
+static void fork_finish () {
 
-  // Allocate a block of the requested size.
-  size_t block_size    = nmemb * size;
-  void*  new_block_ptr = malloc(block_size);
-
-  // If the allocation succeeded, clear the entire block.
-  if (new_block_ptr != NULL) {
-    memset(new_block_ptr, 0, block_size);
+  pthread_mutex_unlock(&slab_lock);
+  for (size_t i = 0; i < num_arenas; i += 1) {
+    pthread_mutex_unlock(&arenas[i].lock);
   }
 
-  return new_block_ptr;
-  
-} // calloc ()
+} // fork_finish ()
 // ==============================================================================
 
 
 
+static void tcache_destroy (void* cache);
+static void remote_drain (arena_s* arena);
+
+
+
 // ==============================================================================
 /**
- * Update the given block at `ptr` to take on the given `size`.  Here, if `size`
- * fits within the given block, then the block is returned unchanged.  If the
- * `size` is an increase for the block, then a new and larger block is
- * allocated, and the data from the old block is copied, the old block freed,
- * and the new block returned.
- *
- * \param ptr  The block to be assigned a new size.
- * \param size The new size that the block should assume.
- * \return     A pointer to the resultant block, which may be `ptr` itself, or
- *             may be a newly allocated block.
+ * The initialization method.  If this is the first use of the heap, initialize
+ * it: create one arena per processor (up to `MAX_ARENAS`), or as many as
+ * `BF_ALLOC_ARENAS` asks for.  The regions of the arenas are mapped when threads
+ * first use them.
  */
-void* realloc (void* ptr, size_t size) {
+void init () {
 
-  // Special case: If there is no original block, then just allocate the new one
-  // of the given size.
-  if (ptr == NULL) {
-    return malloc(size);
+  // Only do anything if there are no arenas (i.e., first time called).
+  if (__atomic_load_n(&num_arenas, __ATOMIC_ACQUIRE) != 0) {
+    return;
   }
 
-  // Special case: If the new size is 0, that's tantamount to freeing the block.
-  if (size == 0) {
-    free(ptr);
-    return NULL;
-  }
+  pthread_mutex_lock(&init_lock);
+  if (num_arenas == 0) {
 
-  // Get the current block size from its header.
-  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+    DEBUG("Trying to initialize");
 
-  // If the new size isn't an increase, then just return the original block as-is.
-  if (size <= header_ptr->size) {
-    return ptr;
-  }
+    // Count the processors without anything that might itself call malloc().
+    cpu_set_t cpus;
+    size_t    count = 1;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+      count = CPU_COUNT(&cpus);
+    }
+    char* arenas_wanted = getenv("BF_ALLOC_ARENAS");
+    if (arenas_wanted != NULL) {
+      count = strtoul(arenas_wanted, NULL, 10);
+    }
+    if (count < 1) {
+      count = 1;
+    } else if (count > MAX_ARENAS) {
+      count = MAX_ARENAS;
+    }
+    for (size_t i = 0; i < count; i += 1) {
+      pthread_mutex_init(&arenas[i].lock, NULL);
+    }
 
-  // The new size is an increase.  Allocate the new, larger block, copy the
-  // contents of the old into it, and free the old.
-  void* new_block_ptr = malloc(size);
-  if (new_block_ptr != NULL) {
-    memcpy(new_block_ptr, ptr, header_ptr->size);
-    free(ptr);
+    char* threshold = getenv("BF_ALLOC_MMAP_THRESHOLD");
+    if (threshold != NULL) {
+      mmap_threshold = strtoul(threshold, NULL, 0);
+    }
+    threshold = getenv("BF_ALLOC_TRIM_THRESHOLD");
+    if (threshold != NULL) {
+      trim_threshold = strtoul(threshold, NULL, 0);
+    }
+    char* pages = getenv("BF_ALLOC_HUGEPAGES");
+    if (pages != NULL && strcmp(pages, "thp") == 0) {
+      huge_pages = HUGE_PAGES_TRANSPARENT;
+    } else if (pages != NULL && strcmp(pages, "hugetlb") == 0) {
+      huge_pages = HUGE_PAGES_EXPLICIT;
+    }
+    char* name = getenv("BF_ALLOC_POLICY");
+    if (name != NULL && strcmp(name, "first") == 0) {
+      policy          = POLICY_FIRST;
+      tree_by_address = true;
+    } else if (name != NULL && strcmp(name, "next") == 0) {
+      policy          = POLICY_NEXT;
+      tree_by_address = true;
+    } else if (name != NULL && strncmp(name, "good", 4) == 0) {
+      policy = POLICY_GOOD;
+      if (name[4] == ':') {
+	good_fit_percent = strtoul(name + 5, NULL, 10);
+      }
+    }
+
+    // Create the key that the thread caches use before any thread can see the
+    // arenas, and publish the arenas before anything below can re-enter
+    // malloc().
+    pthread_key_create(&tcache_key, tcache_destroy);
+    __atomic_store_n(&num_arenas, count, __ATOMIC_RELEASE);
+    pthread_atfork(fork_prepare, fork_finish, fork_finish);
+    trace_start(getenv("BF_ALLOC_TRACE"));
+
+    // DEBUG: Emit a message to indicate that this allocator is being called.
+    DEBUG("bf-alloc initialized");
+
+  }
+  pthread_mutex_unlock(&init_lock);
+
+} // init ()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Insert a large free block into a tree, keeping the tree ordered by size and
+ * then address, and keeping each node's priority above its children's.
+ *
+ * \param root The root of the tree.
+ * \param node The node for the block to insert.
+ */
+static void tree_insert (node_s** root, node_s* node) {
+
+  // Descend to the place where the new node's priority puts it.
+  while (*root != NULL && PRIORITY(*root) > PRIORITY(node)) {
+    root = NODE_BEFORE(node, *root) ? &(*root)->left : &(*root)->right;
+  }
+
+  // Split the subtree found there into the nodes before and after the new one,
+  // which become its children.
+  node_s*  current = *root;
+  node_s** left    = &node->left;
+  node_s** right   = &node->right;
+  while (current != NULL) {
+    if (NODE_BEFORE(current, node)) {
+      *left   = current;
+      left    = &current->right;
+      current = current->right;
+    } else {
+      *right  = current;
+      right   = &current->left;
+      current = current->left;
+    }
+  }
+  *left  = NULL;
+  *right = NULL;
+  *root  = node;
+
+} // tree_insert ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove a large free block from a tree.
+ *
+ * \param root The root of the tree.
+ * \param node The node for the block to remove.
+ */
+static void tree_remove (node_s** root, node_s* node) {
+
+  // Find the link to the node.
+  while (*root != node) {
+    root = NODE_BEFORE(node, *root) ? &(*root)->left : &(*root)->right;
+  }
+
+  // Replace the node by merging its two subtrees, by priority.
+  node_s* left  = node->left;
+  node_s* right = node->right;
+  while (left != NULL && right != NULL) {
+    if (PRIORITY(left) > PRIORITY(right)) {
+      *root = left;
+      root  = &left->right;
+      left  = left->right;
+    } else {
+      *root = right;
+      root  = &right->left;
+      right = right->left;
+    }
+  }
+  *root = (left != NULL) ? left : right;
+
+} // tree_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the best fitting block in a tree: the smallest block whose size is at
+ * least `size`, and the lowest-addressed among those.  For a good fit, stop
+ * early at any block no larger than `limit`.
+ *
+ * \param root  The root of the tree.
+ * \param size  The minimum acceptable size.
+ * \param limit The size at or below which a block is good enough; 0 to find the
+ *              best fit.
+ * \return      The chosen block, or `NULL` if none fits.
+ */
+static header_s* tree_best (node_s* root, size_t size, size_t limit) {
+
+  node_s* best = NULL;
+  while (root != NULL) {
+    if (size <= SIZE(&root->header)) {
+      if (SIZE(&root->header) <= limit) {
+	return &root->header;
+      }
+      best = root;
+      root = root->left;
+    } else {
+      root = root->right;
+    }
+  }
+
+  return (best == NULL) ? NULL : &best->header;
+
+} // tree_best ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Recompute the size of the largest block in a node's subtree of a tree ordered
+ * by address from those of its children.
+ *
+ * \param node The node.
+ */
+static void tree_update (node_s* node) {
+
+  node->largest = SIZE(&node->header);
+  if (node->left != NULL && node->left->largest > node->largest) {
+    node->largest = node->left->largest;
+  }
+  if (node->right != NULL && node->right->largest > node->largest) {
+    node->largest = node->right->largest;
+  }
+
+} // tree_update ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Split a tree ordered by address into the nodes below a given node and those
+ * above it.
+ *
+ * \param root  The root of the tree to split.
+ * \param node  The node at which to split.
+ * \param left  Where to store the root of the nodes below `node`.
+ * \param right Where to store the root of the nodes above `node`.
+ */
+static void tree_split (node_s* root, node_s* node, node_s** left, node_s** right) {
+
+  if (root == NULL) {
+    *left  = NULL;
+    *right = NULL;
+    return;
+  }
+
+  if (root < node) {
+    tree_split(root->right, node, &root->right, right);
+    *left = root;
+  } else {
+    tree_split(root->left, node, left, &root->left);
+    *right = root;
+  }
+  tree_update(root);
+
+} // tree_split ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Merge two trees ordered by address, all of whose nodes in `left` lie below
+ * all of those in `right`, by priority.
+ *
+ * \param left  The root of the lower tree.
+ * \param right The root of the higher tree.
+ * \return      The root of the merged tree.
+ */
+static node_s* tree_merge (node_s* left, node_s* right) {
+
+  if (left == NULL) {
+    return right;
+  }
+  if (right == NULL) {
+    return left;
+  }
+
+  if (PRIORITY(left) > PRIORITY(right)) {
+    left->right = tree_merge(left->right, right);
+    tree_update(left);
+    return left;
+  }
+  right->left = tree_merge(left, right->left);
+  tree_update(right);
+  return right;
+
+} // tree_merge ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Insert a large free block into a tree ordered by address, keeping each node's
+ * priority above its children's, and the size of the largest block in each
+ * subtree up to date.
+ *
+ * \param root The root of the tree.
+ * \param node The node for the block to insert.
+ */
+static void tree_insert_by_address (node_s** root, node_s* node) {
+
+  if (*root == NULL || PRIORITY(*root) <= PRIORITY(node)) {
+    tree_split(*root, node, &node->left, &node->right);
+    tree_update(node);
+    *root = node;
+    return;
+  }
+
+  if ((*root)->largest < SIZE(&node->header)) {
+    (*root)->largest = SIZE(&node->header);
+  }
+  tree_insert_by_address((node < *root) ? &(*root)->left : &(*root)->right, node);
+
+} // tree_insert_by_address ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove a large free block from a tree ordered by address.
+ *
+ * \param root The root of the tree.
+ * \param node The node for the block to remove.
+ */
+static void tree_remove_by_address (node_s** root, node_s* node) {
+
+  // Replace the node by merging its two subtrees.
+  if (*root == node) {
+    *root = tree_merge(node->left, node->right);
+    return;
+  }
+
+  tree_remove_by_address((node < *root) ? &(*root)->left : &(*root)->right, node);
+  tree_update(*root);
+
+} // tree_remove_by_address ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the first fitting block in a tree ordered by address: the lowest-
+ * addressed block, at or above a given address, whose size is at least `size`.
+ * Subtrees with no block large enough are skipped.
+ *
+ * \param root The root of the tree.
+ * \param size The minimum acceptable size.
+ * \param from The lowest acceptable address; 0 for a first fit.
+ * \return     The first fitting block, or `NULL` if none fits.
+ */
+static header_s* tree_first (node_s* root, size_t size, intptr_t from) {
+
+  if (root == NULL || root->largest < size) {
+    return NULL;
+  }
+
+  if ((intptr_t)root >= from) {
+    header_s* header_ptr = tree_first(root->left, size, from);
+    if (header_ptr != NULL) {
+      return header_ptr;
+    }
+    if (SIZE(&root->header) >= size) {
+      return &root->header;
+    }
+  }
+
+  return tree_first(root->right, size, from);
+
+} // tree_first ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Insert a free block at the front of its bin, or into the tree if it is large.
+ *
+ * \param arena      The arena that holds the block.
+ * \param header_ptr The header of the block to insert.
+ */
+static void bin_insert (arena_s* arena, header_s* header_ptr) {
+
+  arena->free_bytes  += SIZE(header_ptr);
+  arena->free_blocks += 1;
+  arena->free_histogram[STATS_BUCKET(SIZE(header_ptr))] += 1;
+
+  if (SIZE(header_ptr) > SMALL_MAX) {
+    if (tree_by_address) {
+      tree_insert_by_address(&arena->tree, (node_s*)header_ptr);
+    } else {
+      tree_insert(&arena->tree, (node_s*)header_ptr);
+    }
+    return;
+  }
+
+  size_t index = SIZE(header_ptr) / ALIGNMENT - 1;
+
+  header_ptr->prev = NULL;
+  header_ptr->next = arena->bins[index];
+  if (arena->bins[index] != NULL) {
+    arena->bins[index]->prev = header_ptr;
+  }
+  arena->bins[index] = header_ptr;
+  arena->binmap[index / 64] |= (uint64_t)1 << (index % 64);
+
+} // bin_insert ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Unlink a free block from its bin, or from the tree if it is large.
+ *
+ * \param arena      The arena that holds the block.
+ * \param header_ptr The header of the block to remove.
+ */
+static void bin_remove (arena_s* arena, header_s* header_ptr) {
+
+  arena->free_bytes  -= SIZE(header_ptr);
+  arena->free_blocks -= 1;
+  arena->free_histogram[STATS_BUCKET(SIZE(header_ptr))] -= 1;
+
+  if (SIZE(header_ptr) > SMALL_MAX) {
+    if (tree_by_address) {
+      tree_remove_by_address(&arena->tree, (node_s*)header_ptr);
+    } else {
+      tree_remove(&arena->tree, (node_s*)header_ptr);
+    }
+    return;
+  }
+
+  size_t index = SIZE(header_ptr) / ALIGNMENT - 1;
+
+  if (header_ptr->prev == NULL) {
+    arena->bins[index] = header_ptr->next;
+    if (arena->bins[index] == NULL) {
+      arena->binmap[index / 64] &= ~((uint64_t)1 << (index % 64));
+    }
+  } else {
+    header_ptr->prev->next = header_ptr->next;
+  }
+  if (header_ptr->next != NULL) {
+    header_ptr->next->prev = header_ptr->prev;
+  }
+
+  header_ptr->prev = NULL;
+  header_ptr->next = NULL;
+
+} // bin_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find a free block of at least `size` bytes.  Every block in a bin has the
+ * bin's exact size, so for a small size, the first non-empty bin at or above
+ * it holds the best fit, whatever the policy.  Failing that, search the tree
+ * for the block that the placement policy chooses.
+ *
+ * \param arena The arena to search.
+ * \param size  The minimum acceptable size; a multiple of `ALIGNMENT`.
+ * \return      The chosen free block, or `NULL` if there is none.
+ */
+static header_s* find_fit (arena_s* arena, size_t size) {
+
+  // Use the bitmap to skip directly to the first non-empty bin that fits.
+  if (size <= SMALL_MAX) {
+    size_t index = size / ALIGNMENT - 1;
+    for (size_t word = index / 64; word < BINMAP_WORDS; word += 1) {
+      uint64_t bits = arena->binmap[word];
+      if (word == index / 64) {
+	bits &= ~(uint64_t)0 << (index % 64);
+      }
+      if (bits != 0) {
+	return arena->bins[word * 64 + __builtin_ctzl(bits)];
+      }
+    }
+  }
+
+  header_s* header_ptr = NULL;
+  switch (policy) {
+  case POLICY_BEST:
+    header_ptr = tree_best(arena->tree, size, 0);
+    break;
+  case POLICY_GOOD:
+    header_ptr = tree_best(arena->tree, size, size + size * good_fit_percent / 100);
+    break;
+  case POLICY_FIRST:
+    header_ptr = tree_first(arena->tree, size, 0);
+    break;
+  case POLICY_NEXT:
+    header_ptr = tree_first(arena->tree, size, arena->rover);
+    if (header_ptr == NULL) {
+      header_ptr = tree_first(arena->tree, size, 0);
+    }
+    if (header_ptr != NULL) {
+      arena->rover = (intptr_t)header_ptr + size;
+    }
+    break;
+  }
+
+  return header_ptr;
+
+} // find_fit ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the whole pages within a range to the kernel.  Their contents are
+ * lost, and they read as zeros when next touched.  (A region backed by explicit
+ * huge pages refuses to return less than a whole huge page.)
+ *
+ * \param start The beginning of the range.
+ * \param end   The end of the range.
+ * \return      The number of bytes returned.
+ */
+static size_t release_pages (intptr_t start, intptr_t end) {
+
+  intptr_t page_size = PAGE_SIZE;
+  start = (start + page_size - 1) & ~(page_size - 1);
+  end   = end & ~(page_size - 1);
+  if (start >= end) {
+    return 0;
+  }
+
+  if (madvise((void*)start, end - start, MADV_DONTNEED) != 0) {
+    return 0;
+  }
+  return end - start;
+
+} // release_pages ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the pages of a free block within a range to the kernel, sparing the
+ * block's header (with its links, or its place in the tree) and footer.
+ *
+ * \param header_ptr The header of the free block.
+ * \param start      The beginning of the range to trim.
+ * \param end        The end of the range to trim.
+ * \return           The number of bytes returned.
+ */
+static size_t trim_block (header_s* header_ptr, intptr_t start, intptr_t end) {
+
+  if (start >= end) {
+    return 0;
+  }
+
+  intptr_t block_start = (intptr_t)header_ptr + sizeof(node_s);
+  intptr_t block_end   = (intptr_t)FOOTER(header_ptr);
+
+  return release_pages((start > block_start) ? start : block_start,
+		       (end < block_end) ? end : block_end);
+
+} // trim_block ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the pages of every block in a tree of large free blocks to the kernel.
+ * (Blocks in the bins are too small to have any whole pages.)
+ *
+ * \param root The root of the tree.
+ * \return     The number of bytes returned.
+ */
+static size_t trim_tree (node_s* root) {
+
+  if (root == NULL) {
+    return 0;
+  }
+
+  return (trim_block(&root->header, (intptr_t)root, BLOCK_END(&root->header)) +
+	  trim_tree(root->left) +
+	  trim_tree(root->right));
+
+} // trim_tree ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the touched pages above an arena's free address to the kernel, but for
+ * `pad` bytes.  The page holding the dirty address is touched only below it, so
+ * it goes too, and the dirty address drops to the start of what was returned.
+ * The arena must be locked.
+ *
+ * \param arena The arena to trim.
+ * \param pad   The number of bytes above the free address to leave alone.
+ * \return      The number of bytes returned.
+ */
+static size_t trim_top (arena_s* arena, size_t pad) {
+
+  intptr_t page_size = PAGE_SIZE;
+  intptr_t end       = (arena->dirty_addr + page_size - 1) & ~(page_size - 1);
+  size_t   released  = release_pages(arena->free_addr + pad, end);
+  if (released > 0) {
+    arena->dirty_addr = end - released;
+  }
+
+  return released;
+
+} // trim_top ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Turn a block that is on no list into free space.  Merge it with its free
+ * physical neighbours, and then either return the result to the unallocated
+ * region (if it is the topmost block) or add it to its bin.  If the result is
+ * large enough, return the pages of the newly freed space to the kernel; any
+ * large neighbours were trimmed when they were freed.
+ *
+ * \param arena      The arena that holds the block.
+ * \param header_ptr The header of the block to release.
+ */
+static void release (arena_s* arena, header_s* header_ptr) {
+
+  header_ptr->size    &= ~(ALLOCATED | MAPPED);
+  intptr_t dirty_start  = (intptr_t)header_ptr;
+  intptr_t dirty_end    = BLOCK_END(header_ptr);
+  size_t   threshold    = trim_threshold;
+
+  // Merge with the preceding block, found through its footer, if it is free.
+  if (!(header_ptr->size & PREV_ALLOCATED)) {
+    header_s* prev_ptr = PREV_HEADER(header_ptr);
+    if (SIZE(prev_ptr) < threshold) {
+      dirty_start = (intptr_t)prev_ptr;
+    }
+    bin_remove(arena, prev_ptr);
+    prev_ptr->size += SIZE(header_ptr);
+    header_ptr = prev_ptr;
+  }
+
+  // If this is now the topmost block, give its space back to the unallocated
+  // region.
+  header_s* next_ptr = (header_s*)BLOCK_END(header_ptr);
+  if ((intptr_t)next_ptr == arena->free_addr) {
+    arena->free_addr = (intptr_t)header_ptr;
+    if (arena->dirty_addr - arena->free_addr >= (intptr_t)threshold) {
+      trim_top(arena, 0);
+    }
+    return;
+  }
+
+  // Otherwise, merge with the following block if it is free.
+  if (!(next_ptr->size & ALLOCATED)) {
+    if (SIZE(next_ptr) < threshold) {
+      dirty_end = BLOCK_END(next_ptr);
+    }
+    bin_remove(arena, next_ptr);
+    header_ptr->size += SIZE(next_ptr);
+    next_ptr = (header_s*)BLOCK_END(header_ptr);
+  }
+
+  // Tag the merged block and put it into its bin.
+  *FOOTER(header_ptr)  = SIZE(header_ptr);
+  next_ptr->size      &= ~PREV_ALLOCATED;
+  bin_insert(arena, header_ptr);
+
+  if (SIZE(header_ptr) >= threshold) {
+    trim_block(header_ptr, dirty_start, dirty_end);
+  }
+
+} // release ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Shrink a block that is on no list to `size` bytes, releasing the remainder as
+ * a block of its own, but only if the remainder can be a minimum-sized block.
+ *
+ * \param arena      The arena that holds the block.
+ * \param header_ptr The header of the block to split.
+ * \param size       The new size of the block; a multiple of `ALIGNMENT`.
+ */
+static void split (arena_s* arena, header_s* header_ptr, size_t size) {
+
+  if (SIZE(header_ptr) < size + MIN_BLOCK_SIZE) {
+    return;
+  }
+
+  header_s* rest_ptr = (header_s*)((intptr_t)header_ptr + size);
+  rest_ptr->size     = (SIZE(header_ptr) - size) | PREV_ALLOCATED;
+  header_ptr->size   = size | (header_ptr->size & FLAGS);
+  release(arena, rest_ptr);
+
+} // split ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Give an arena a new region, twice the size of its current one (up to
+ * `REGION_SIZE_MAX`) but at least large enough for a block of `size` bytes.
+ * Seal the current region first: return its untouched pages to the kernel,
+ * release the space left at its top as a free block (if there is room for
+ * one), and end it with a zero-sized allocated _fence_ block, so that nothing
+ * ever merges past it.  The arena must be locked.
+ *
+ * \param arena The arena to grow.
+ * \param size  The size of the block that did not fit; a multiple of
+ *              `ALIGNMENT`.
+ * \return      `true` if the arena has a new region; `false` otherwise (leaving
+ *              the current one as it was).
+ */
+static bool arena_grow (arena_s* arena, size_t size) {
+
+  size_t region_size = (arena->region_size < REGION_SIZE_MAX) ? 2 * arena->region_size : REGION_SIZE_MAX;
+  size_t needed      = (size + ALIGNMENT + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  if (region_size < needed) {
+    region_size = needed;
+  }
+
+  trim_top(arena, 0);
+  intptr_t  top_addr   = arena->free_addr;
+  intptr_t  end_addr   = arena->end_addr;
+  size_t    used_bytes = end_addr - arena->start_addr - HEADER_OFFSET;
+  if (!arena_add_region(arena, region_size)) {
+    return false;
+  }
+  arena->sealed_bytes += used_bytes;
+
+  // Fence off the old region.  The topmost block is never free, so the space
+  // left above it follows an allocated block.
+  header_s* top_ptr = (header_s*)top_addr;
+  if (end_addr - top_addr < (intptr_t)MIN_BLOCK_SIZE) {
+    top_ptr->size = (end_addr - top_addr) | ALLOCATED | PREV_ALLOCATED;
+  } else {
+    ((header_s*)end_addr)->size = ALLOCATED | PREV_ALLOCATED;
+    top_ptr->size               = (end_addr - top_addr) | ALLOCATED | PREV_ALLOCATED;
+    release(arena, top_ptr);
+  }
+
+  return true;
+
+} // arena_grow ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes from an arena.  Specifically, search the bins, choosing
+ * a block by the placement policy (the _best fit_, by default), and split off
+ * any excess.  If no such block is available,
+ * expand into the arena's current region via _pointer bumping_, moving on to a
+ * new region if it is full.  The arena must be locked.
+ *
+ * \param arena The arena from which to allocate.
+ * \param size  The size of block to allocate; a multiple of `ALIGNMENT`.
+ * \return      The header of the allocated block, if successful; `NULL` if
+ *              unsuccessful.
+ */
+static header_s* arena_malloc (arena_s* arena, size_t size) {
+
+  arena_init(arena);
+
+  // Take the chosen free block, if there is one.
+  header_s* header_ptr = find_fit(arena, size);
+  if (header_ptr != NULL) {
+
+    // A free block is never the topmost one, so it always has a successor.
+    // Hand out only what was asked for, returning any sizeable tail.
+    bin_remove(arena, header_ptr);
+    header_ptr->size |= ALLOCATED;
+    ((header_s*)BLOCK_END(header_ptr))->size |= PREV_ALLOCATED;
+    split(arena, header_ptr, size);
+
+  } else {
+
+    // Expand the heap.  Every block size is a multiple of `ALIGNMENT`, so the
+    // free address remains aligned.  The topmost block is never free, so the
+    // new block's predecessor (if any) is allocated.
+    header_ptr = (header_s*)arena->free_addr;
+    intptr_t new_free_addr = (intptr_t)header_ptr + size;
+    if (new_free_addr > arena->end_addr) {
+      if (!arena_grow(arena, size)) {
+	return NULL;
+      }
+      header_ptr    = (header_s*)arena->free_addr;
+      new_free_addr = (intptr_t)header_ptr + size;
+    }
+    arena->free_addr = new_free_addr;
+    if (arena->dirty_addr < new_free_addr) {
+      arena->dirty_addr = new_free_addr;
+    }
+    header_ptr->size = size | ALLOCATED | PREV_ALLOCATED;
+
+  }
+
+  return header_ptr;
+
+} // arena_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes from an arena, with the block aligned to a multiple of
+ * `alignment`.  Allocate enough to be sure of containing an aligned block, then
+ * release the excess on either side, so that only a minimum-sized block's worth
+ * of padding may be tied up, and even that is free for reuse.  The arena must
+ * be locked.
+ *
+ * \param arena     The arena from which to allocate.
+ * \param alignment The alignment of the block; a power of two greater than
+ *                  `ALIGNMENT`.
+ * \param size      The size of block to allocate; a multiple of `ALIGNMENT`.
+ * \return          The header of the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+static header_s* arena_memalign (arena_s* arena, size_t alignment, size_t size) {
+
+  header_s* header_ptr = arena_malloc(arena, size + alignment - ALIGNMENT + MIN_BLOCK_SIZE);
+  if (header_ptr == NULL) {
+    return NULL;
+  }
+
+  // If the block is misaligned, release a leading block of its own, just large
+  // enough to reach an aligned address.
+  intptr_t block_ptr = (intptr_t)HEADER_TO_BLOCK(header_ptr);
+  if ((block_ptr & (alignment - 1)) != 0) {
+    intptr_t  aligned_ptr = (block_ptr + MIN_BLOCK_SIZE + alignment - 1) & ~(intptr_t)(alignment - 1);
+    size_t    lead_size   = aligned_ptr - block_ptr;
+    header_s* lead_ptr    = header_ptr;
+    header_ptr            = BLOCK_TO_HEADER(aligned_ptr);
+    header_ptr->size      = (SIZE(lead_ptr) - lead_size) | ALLOCATED | PREV_ALLOCATED;
+    lead_ptr->size        = lead_size | (lead_ptr->size & FLAGS);
+    release(arena, lead_ptr);
+  }
+
+  split(arena, header_ptr, size);
+
+  return header_ptr;
+
+} // arena_memalign ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Resize an allocated block in place, if possible.  A shrinking block has any
+ * sizeable tail released.  A growing block is extended by bumping the free
+ * address when it is the topmost block, or by absorbing a large enough free
+ * successor.  The arena must be locked.
+ *
+ * \param arena      The arena that holds the block.
+ * \param header_ptr The header of the block to resize.
+ * \param new_size   The new size of the block; a multiple of `ALIGNMENT`.
+ * \return           `true` if the block now has (at least) `new_size` bytes;
+ *                   `false` if it could not be grown in place.
+ */
+static bool arena_resize (arena_s* arena, header_s* header_ptr, size_t new_size) {
+
+  // If the new size isn't an increase, then keep the block, trimming its tail.
+  if (new_size <= SIZE(header_ptr)) {
+    split(arena, header_ptr, new_size);
+    return true;
+  }
+
+  // If this is the topmost block, grow it by bumping the free address.
+  header_s* next_ptr = (header_s*)BLOCK_END(header_ptr);
+  if ((intptr_t)next_ptr == arena->free_addr) {
+    intptr_t new_free_addr = (intptr_t)header_ptr + new_size;
+    if (new_free_addr <= arena->end_addr) {
+      arena->free_addr = new_free_addr;
+      if (arena->dirty_addr < new_free_addr) {
+	arena->dirty_addr = new_free_addr;
+      }
+      header_ptr->size = new_size | (header_ptr->size & FLAGS);
+      return true;
+    }
+  }
+
+  // If the following block is free and large enough, absorb it, trimming any
+  // excess.
+  else if (!(next_ptr->size & ALLOCATED) &&
+	   SIZE(header_ptr) + SIZE(next_ptr) >= new_size) {
+    bin_remove(arena, next_ptr);
+    header_ptr->size += SIZE(next_ptr);
+    ((header_s*)BLOCK_END(header_ptr))->size |= PREV_ALLOCATED;
+    split(arena, header_ptr, new_size);
+    return true;
+  }
+
+  return false;
+
+} // arena_resize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the arena whose region contains a block, through the table of regions.
+ *
+ * \param ptr A pointer to the block.
+ * \return    The arena that holds the block, or `NULL` if there is none.
+ */
+static arena_s* arena_of (void* ptr) {
+
+  size_t count = __atomic_load_n(&num_regions, __ATOMIC_RELAXED);
+  if (count > MAX_REGIONS) {
+    count = MAX_REGIONS;
+  }
+  for (size_t i = 0; i < count; i += 1) {
+    intptr_t start_addr = __atomic_load_n(&regions[i].start_addr, __ATOMIC_ACQUIRE);
+    if (start_addr != 0 &&
+	start_addr <= (intptr_t)ptr && (intptr_t)ptr < regions[i].end_addr) {
+      return regions[i].arena;
+    }
+  }
+
+  return NULL;
+
+} // arena_of ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Lock an arena for this thread to allocate from, and free the blocks in its
+ * queue of remote frees.  Threads are first assigned arenas round-robin; a
+ * thread that finds its arena busy moves to any other arena that is not, so
+ * that contended threads spread themselves out.
+ *
+ * \return The locked arena.
+ */
+static arena_s* arena_lock () {
+
+  if (thread_arena == NULL) {
+    size_t i = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % num_arenas;
+    thread_arena = &arenas[i];
+  }
+  if (pthread_mutex_trylock(&thread_arena->lock) == 0) {
+    remote_drain(thread_arena);
+    return thread_arena;
+  }
+
+  size_t home = thread_arena - arenas;
+  for (size_t i = 1; i < num_arenas; i += 1) {
+    arena_s* arena = &arenas[(home + i) % num_arenas];
+    if (pthread_mutex_trylock(&arena->lock) == 0) {
+      thread_arena = arena;
+      remote_drain(arena);
+      return arena;
+    }
+  }
+
+  pthread_mutex_lock(&thread_arena->lock);
+  remote_drain(thread_arena);
+  return thread_arena;
+
+} // arena_lock ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Is a block one of the small objects in the slab space?  The slab space is
+ * searched through its table of segments, since a small object has no header
+ * to say so.
+ *
+ * \param ptr A pointer to the block.
+ * \return    `true` if the block lies in a slab; `false` otherwise.
+ */
+static bool in_slab_space (void* ptr) {
+
+  size_t count = __atomic_load_n(&num_slab_segments, __ATOMIC_ACQUIRE);
+  for (size_t i = 0; i < count; i += 1) {
+    if (slab_segments[i].start_addr <= (intptr_t)ptr &&
+	(intptr_t)ptr < slab_segments[i].end_addr) {
+      return true;
+    }
+  }
+
+  return false;
+
+} // in_slab_space ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Map a new segment of the slab space, twice the size of the current one (up to
+ * `SLAB_SEGMENT_SIZE_MAX`), record it in the table of segments, and carve slabs
+ * from it next.  Its first pages hold its bitmap of untouched empty slabs.  The
+ * slab space must be locked.
+ *
+ * \return `true` if the segment was added; `false` if there is no room for it,
+ *         in the address space or in the table.
+ */
+static bool slab_add_segment (void) {
+
+  if (num_slab_segments >= MAX_SLAB_SEGMENTS) {
+    return false;
+  }
+  size_t size = ((slab_segment_size == 0) ? SLAB_SEGMENT_SIZE :
+		 (slab_segment_size < SLAB_SEGMENT_SIZE_MAX) ? 2 * slab_segment_size :
+		 SLAB_SEGMENT_SIZE_MAX);
+  void*  segment = map_region(size);
+  if (segment == MAP_FAILED) {
+    return false;
+  }
+
+  // Publish the segment, completing the table last.
+  slab_segment_s* entry = &slab_segments[num_slab_segments];
+  size_t map_bytes = (size / SLAB_SIZE / 8 + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
+  entry->start_addr = (intptr_t)segment;
+  entry->end_addr   = (intptr_t)segment + size;
+  entry->clean_map  = segment;
+  __atomic_store_n(&num_slab_segments, num_slab_segments + 1, __ATOMIC_RELEASE);
+
+  slab_free_addr    = (intptr_t)segment + map_bytes;
+  slab_end_addr     = (intptr_t)segment + size;
+  slab_segment_size = size;
+
+  return true;
+
+} // slab_add_segment ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the pages of pooled empty slabs to the kernel until the pool holds no
+ * more than `keep` bytes, marking each slab as untouched in its segment's
+ * bitmap.  The slab space must be locked.
+ *
+ * \param keep The number of bytes of empty slabs to keep touched.
+ * \return     The number of bytes returned.
+ */
+static size_t slab_trim (size_t keep) {
+
+  size_t released = 0;
+  while (slab_pool_count * SLAB_SIZE > keep) {
+
+    // The slab's link is lost with its pages, so read it first.
+    slab_s* slab = slab_pool;
+    slab_s* next = slab->next;
+    if (release_pages((intptr_t)slab, (intptr_t)slab + SLAB_SIZE) == 0) {
+      break;
+    }
+    slab_pool        = next;
+    slab_pool_count -= 1;
+    released        += SLAB_SIZE;
+
+    for (size_t i = 0; i < num_slab_segments; i += 1) {
+      slab_segment_s* segment = &slab_segments[i];
+      if (segment->start_addr <= (intptr_t)slab && (intptr_t)slab < segment->end_addr) {
+	size_t index = ((intptr_t)slab - segment->start_addr) / SLAB_SIZE;
+	segment->clean_map[index / 64] |= (uint64_t)1 << (index % 64);
+	slab_clean_count += 1;
+	break;
+      }
+    }
+
+  }
+
+  return released;
+
+} // slab_trim ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take an empty slab from the slab space: a pooled one, if there is one, or else
+ * an untouched one, or else a new one carved from the current segment (moving
+ * on to a new segment if it is full).
+ *
+ * \return The slab, uninitialized, or `NULL` if there is no room for another.
+ */
+static slab_s* slab_take (void) {
+
+  slab_s* slab = NULL;
+  pthread_mutex_lock(&slab_lock);
+
+  if (slab_pool != NULL) {
+
+    slab             = slab_pool;
+    slab_pool        = slab->next;
+    slab_pool_count -= 1;
+
+  } else if (slab_clean_count > 0) {
+
+    for (size_t i = 0; i < num_slab_segments && slab == NULL; i += 1) {
+      slab_segment_s* segment = &slab_segments[i];
+      size_t          words   = (segment->end_addr - segment->start_addr) / SLAB_SIZE / 64;
+      for (size_t word = 0; word < words; word += 1) {
+	uint64_t bits = segment->clean_map[word];
+	if (bits != 0) {
+	  size_t index = word * 64 + __builtin_ctzl(bits);
+	  segment->clean_map[word] &= bits - 1;
+	  slab_clean_count         -= 1;
+	  slab = (slab_s*)(segment->start_addr + index * SLAB_SIZE);
+	  break;
+	}
+      }
+    }
+
+  } else if (slab_free_addr + (intptr_t)SLAB_SIZE <= slab_end_addr || slab_add_segment()) {
+
+    slab              = (slab_s*)slab_free_addr;
+    slab_free_addr   += SLAB_SIZE;
+    slab_space_bytes += SLAB_SIZE;
+
+  }
+
+  pthread_mutex_unlock(&slab_lock);
+  return slab;
+
+} // slab_take ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return an empty slab to the pool, for reuse by any arena and size class.  If
+ * the pool has reached twice the trim threshold, return the pages of its slabs
+ * to the kernel until it is down to the threshold.  Slabs empty and fill again
+ * in bulk as a program's small objects come and go, so the pool is given more
+ * slack than a single free block would be.
+ *
+ * \param slab The empty slab, on no list.
+ */
+static void slab_discard (slab_s* slab) {
+
+  pthread_mutex_lock(&slab_lock);
+  slab->next       = slab_pool;
+  slab_pool        = slab;
+  slab_pool_count += 1;
+  if (slab_pool_count * SLAB_SIZE >= 2 * trim_threshold) {
+    slab_trim(trim_threshold);
+  }
+  pthread_mutex_unlock(&slab_lock);
+
+} // slab_discard ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Link a slab into the front of its arena's list for its size class.  The arena
+ * must be locked.
+ *
+ * \param arena The arena that allocates from the slab.
+ * \param slab  The slab, which must have a free object.
+ */
+static void slab_link (arena_s* arena, slab_s* slab) {
+
+  size_t index = slab->object_size / ALIGNMENT - 1;
+
+  slab->prev = NULL;
+  slab->next = arena->slabs[index];
+  if (slab->next != NULL) {
+    slab->next->prev = slab;
+  }
+  arena->slabs[index] = slab;
+
+} // slab_link ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Unlink a slab from its arena's list for its size class.  The arena must be
+ * locked.
+ *
+ * \param arena The arena that allocates from the slab.
+ * \param slab  The slab.
+ */
+static void slab_unlink (arena_s* arena, slab_s* slab) {
+
+  if (slab->prev == NULL) {
+    arena->slabs[slab->object_size / ALIGNMENT - 1] = slab->next;
+  } else {
+    slab->prev->next = slab->next;
+  }
+  if (slab->next != NULL) {
+    slab->next->prev = slab->prev;
+  }
+
+  slab->prev = NULL;
+  slab->next = NULL;
+
+} // slab_unlink ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a small object from one of an arena's slabs, starting a new slab for
+ * its size class if the arena has none with a free object.  Within a slab, the
+ * lowest free object is taken, so that objects stay densely packed.  The arena
+ * must be locked.
+ *
+ * \param arena       The arena from which to allocate.
+ * \param object_size The size of object to allocate; a multiple of `ALIGNMENT`,
+ *                    at most `SLAB_MAX`.
+ * \return            The object, if successful; `NULL` if unsuccessful.
+ */
+static void* slab_malloc (arena_s* arena, size_t object_size) {
+
+  slab_s* slab = arena->slabs[object_size / ALIGNMENT - 1];
+  if (slab == NULL) {
+    slab = slab_take();
+    if (slab == NULL) {
+      return NULL;
+    }
+    slab->arena       = arena;
+    slab->object_size = object_size;
+    slab->capacity    = (SLAB_SIZE - SLAB_HEADER_SIZE) / object_size;
+    slab->used        = 0;
+    for (size_t word = 0; word < SLAB_MAP_WORDS; word += 1) {
+      size_t left = (slab->capacity > word * 64) ? slab->capacity - word * 64 : 0;
+      slab->free_map[word] = (left >= 64) ? ~(uint64_t)0 : ((uint64_t)1 << left) - 1;
+    }
+    slab_link(arena, slab);
+  }
+
+  // A slab on the list has a free object; take it, and drop the slab from the
+  // list if that was its last.
+  size_t word = 0;
+  while (slab->free_map[word] == 0) {
+    word += 1;
+  }
+  size_t index = word * 64 + __builtin_ctzl(slab->free_map[word]);
+  slab->free_map[word] &= slab->free_map[word] - 1;
+  slab->used           += 1;
+  if (slab->used == slab->capacity) {
+    slab_unlink(arena, slab);
+  }
+  arena->slab_bytes += object_size;
+
+  return (void*)((intptr_t)slab + SLAB_HEADER_SIZE + index * object_size);
+
+} // slab_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return a small object to its slab.  A slab that was full goes back on its
+ * arena's list; one that is now empty goes to the pool, unless it is the only
+ * slab on the list, which is kept to spare the next allocation from starting
+ * another.  The arena must be locked.
+ *
+ * \param arena The arena that allocates from the object's slab.
+ * \param ptr   The object.
+ */
+static void slab_free (arena_s* arena, void* ptr) {
+
+  slab_s* slab   = SLAB_OF(ptr);
+  size_t  offset = (intptr_t)ptr - (intptr_t)slab - SLAB_HEADER_SIZE;
+  size_t  index  = offset / slab->object_size;
+  if (offset % slab->object_size != 0 || index >= slab->capacity) {
+    ERROR("free(): Not an allocated block: ", (intptr_t)ptr);
+  }
+  uint64_t bit = (uint64_t)1 << (index % 64);
+  if (slab->free_map[index / 64] & bit) {
+    ERROR("Double-free: ", (intptr_t)ptr);
+  }
+
+  slab->free_map[index / 64] |= bit;
+  arena->slab_bytes          -= slab->object_size;
+  if (slab->used == slab->capacity) {
+    slab_link(arena, slab);
+  }
+  slab->used -= 1;
+  if (slab->used == 0 && (slab->prev != NULL || slab->next != NULL)) {
+    slab_unlink(arena, slab);
+    slab_discard(slab);
+  }
+
+} // slab_free ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Push a chain of freed blocks onto an arena's queue of remote frees, without
+ * taking its lock.  Blocks are only ever pushed one chain at a time and taken
+ * all at once, so a compare-and-swap on the head suffices.  A block that is
+ * already at the head is being freed twice.
+ *
+ * \param arena The arena that holds the blocks.
+ * \param first The first block of the chain.
+ * \param last  The last block of the chain, whose link is set here.
+ */
+static void remote_push (arena_s* arena, void* first, void* last) {
+
+  void* head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+  do {
+    if (head == first) {
+      ERROR("Double-free: ", (intptr_t)first);
+    }
+    REMOTE_NEXT(last) = head;
+  } while (!__atomic_compare_exchange_n(&arena->remote_frees,
+					&head,
+					first,
+					true,
+					__ATOMIC_RELEASE,
+					__ATOMIC_RELAXED));
+
+} // remote_push ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take every block from an arena's queue of remote frees and free it: a small
+ * object to its slab, and any other block to the arena's bins.  The arena must
+ * be locked; every thread that locks it calls this, so that the blocks freed to
+ * an arena that its own threads have left are still reclaimed.
+ *
+ * \param arena The arena.
+ */
+static void remote_drain (arena_s* arena) {
+
+  if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+
+  void* block_ptr = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+  while (block_ptr != NULL) {
+
+    void* next_ptr = REMOTE_NEXT(block_ptr);
+    if (in_slab_space(block_ptr)) {
+      slab_free(arena, block_ptr);
+    } else {
+      header_s* header_ptr = BLOCK_TO_HEADER(block_ptr);
+      if (!(header_ptr->size & ALLOCATED)) {
+	ERROR("Double-free: ", (intptr_t)header_ptr);
+      }
+      release(arena, header_ptr);
+    }
+    block_ptr = next_ptr;
+
+  }
+
+} // remote_drain ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return cached objects to their slabs until a thread cache list is down to a
+ * given length.  Consecutive objects from this thread's arena share one
+ * locking; consecutive objects from any other arena are pushed onto its queue
+ * of remote frees as one chain, leaving its lock to the threads that allocate
+ * from it.
+ *
+ * \param index The list to flush.
+ * \param keep  The number of objects to leave in the list.
+ */
+static void tcache_flush (size_t index, uint32_t keep) {
+
+  arena_s* locked = NULL;
+  while (tcache.counts[index] > keep) {
+
+    void* block_ptr = tcache.heads[index];
+    tcache.heads[index]   = CACHE_NEXT(block_ptr);
+    tcache.counts[index] -= 1;
+
+    arena_s* arena = SLAB_OF(block_ptr)->arena;
+    if (arena != thread_arena) {
+      void* last_ptr = block_ptr;
+      while (tcache.counts[index] > keep &&
+	     SLAB_OF(tcache.heads[index])->arena == arena) {
+	REMOTE_NEXT(last_ptr) = tcache.heads[index];
+	last_ptr              = tcache.heads[index];
+	tcache.heads[index]   = CACHE_NEXT(last_ptr);
+	tcache.counts[index] -= 1;
+      }
+      remote_push(arena, block_ptr, last_ptr);
+      continue;
+    }
+
+    if (arena != locked) {
+      if (locked != NULL) {
+	pthread_mutex_unlock(&locked->lock);
+      }
+      pthread_mutex_lock(&arena->lock);
+      remote_drain(arena);
+      locked = arena;
+    }
+    slab_free(arena, block_ptr);
+
+  }
+  if (locked != NULL) {
+    pthread_mutex_unlock(&locked->lock);
+  }
+
+} // tcache_flush ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Flush a thread's entire cache when the thread exits, and stop using it, since
+ * the thread may still free blocks on its way out.
+ *
+ * \param cache The cache being destroyed (the thread's own `tcache`).
+ */
+static void tcache_destroy (void* cache) {
+
+  (void)cache;
+  tcache.dead = true;
+  for (size_t i = 0; i < TCACHE_BINS; i += 1) {
+    tcache_flush(i, 0);
+  }
+
+} // tcache_destroy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a small object of exactly `object_size` bytes from this thread's cache,
+ * if it has one.
+ *
+ * \param object_size The size of object wanted; a multiple of `ALIGNMENT`, at
+ *                    most `SLAB_MAX`.
+ * \return            The object, or `NULL` if the cache has none of that size.
+ */
+static void* tcache_get (size_t object_size) {
+
+  size_t index     = object_size / ALIGNMENT - 1;
+  void*  block_ptr = tcache.heads[index];
+  if (block_ptr != NULL) {
+    tcache.heads[index]   = CACHE_NEXT(block_ptr);
+    tcache.counts[index] -= 1;
+    CACHE_KEY(block_ptr)  = NULL;
+  }
+
+  return block_ptr;
+
+} // tcache_get ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Put a freed small object into this thread's cache, flushing half of the
+ * relevant list to make room if it is full.  An object that bears this cache's
+ * key may already be in it; the list is searched to be sure.
+ *
+ * \param ptr The object being freed.
+ * \return    `true` if the object was cached; `false` if it must be returned to
+ *            its slab instead.
+ */
+static bool tcache_put (void* ptr) {
+
+  if (tcache.dead) {
+    return false;
+  }
+
+  // Make sure that the cache will be flushed when this thread exits.
+  if (!tcache.registered) {
+    tcache.registered = true;
+    pthread_setspecific(tcache_key, &tcache);
+  }
+
+  size_t index = SLAB_OF(ptr)->object_size / ALIGNMENT - 1;
+  if (CACHE_KEY(ptr) == &tcache) {
+    void* block_ptr = tcache.heads[index];
+    while (block_ptr != NULL) {
+      if (block_ptr == ptr) {
+	ERROR("Double-free: ", (intptr_t)ptr);
+      }
+      block_ptr = CACHE_NEXT(block_ptr);
+    }
+  }
+  if (tcache.counts[index] >= TCACHE_COUNT) {
+    tcache_flush(index, TCACHE_COUNT / 2);
+  }
+
+  CACHE_NEXT(ptr)        = tcache.heads[index];
+  CACHE_KEY(ptr)         = &tcache;
+  tcache.heads[index]    = ptr;
+  tcache.counts[index]  += 1;
+
+  return true;
+
+} // tcache_put ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block in a mapping of its own, with the block aligned to a multiple
+ * of `alignment`.  The header is offset from the start of the mapping so that
+ * the block is aligned; for an alignment beyond a page, map enough to be sure of
+ * containing an aligned block, and then unmap the excess pages on either side.
+ *
+ * \param alignment The alignment of the block; a power of two, at least
+ *                  `ALIGNMENT`.
+ * \param size      The size of block to allocate; a multiple of `ALIGNMENT`.
+ * \return          The header of the new block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+static header_s* mapped_malloc (size_t alignment, size_t size) {
+
+  size_t page_size = PAGE_SIZE;
+  size_t slack     = alignment - ALIGNMENT;
+  size_t length    = (2 * HEADER_OFFSET + slack + size + page_size - 1) & ~(page_size - 1);
+  void*  mapping   = mmap(NULL,
+			  length,
+			  PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS,
+			  -1,
+			  0);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  // Place the block at the first aligned address past the header's offset.
+  intptr_t  block_ptr  = ((intptr_t)mapping + ALIGNMENT + slack) & ~(intptr_t)(alignment - 1);
+  header_s* header_ptr = BLOCK_TO_HEADER(block_ptr);
+
+  // Unmap any whole pages before the header and after the block.
+  intptr_t start = (intptr_t)MAPPING_START(header_ptr);
+  intptr_t end   = (block_ptr + size + page_size - 1) & ~(intptr_t)(page_size - 1);
+  if (start > (intptr_t)mapping) {
+    munmap(mapping, start - (intptr_t)mapping);
+  }
+  if (end < (intptr_t)mapping + (intptr_t)length) {
+    munmap((void*)end, (intptr_t)mapping + length - end);
+  }
+
+  // The block owns the rest of the mapping, so its size covers the rounding slack.
+  header_ptr->size = (end - HEADER_OFFSET - (intptr_t)header_ptr) | ALLOCATED | PREV_ALLOCATED | MAPPED;
+
+  __atomic_add_fetch(&mapped_bytes, SIZE(header_ptr), __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mapped_blocks, 1, __ATOMIC_RELAXED);
+
+  return header_ptr;
+
+} // mapped_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Resize a block that has its own mapping, moving the mapping if necessary.  The
+ * header keeps its offset within the mapping, so the block keeps any alignment
+ * up to a page.
+ *
+ * \param header_ptr The header of the block to resize.
+ * \param size       The new size of the block; a multiple of `ALIGNMENT`.
+ * \return           The header of the resized block, if successful; `NULL` if
+ *                   unsuccessful (leaving the block as it was).
+ */
+static header_s* mapped_realloc (header_s* header_ptr, size_t size) {
+
+  size_t page_size = PAGE_SIZE;
+  size_t old_size  = SIZE(header_ptr);
+  size_t offset    = (intptr_t)header_ptr - (intptr_t)MAPPING_START(header_ptr);
+  size_t length    = (offset + HEADER_OFFSET + size + page_size - 1) & ~(page_size - 1);
+  void*  mapping   = mremap(MAPPING_START(header_ptr),
+			    MAPPING_LENGTH(header_ptr),
+			    length,
+			    MREMAP_MAYMOVE);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  header_ptr       = (header_s*)((intptr_t)mapping + offset);
+  header_ptr->size = (length - offset - HEADER_OFFSET) | (header_ptr->size & FLAGS);
+
+  __atomic_add_fetch(&mapped_bytes, SIZE(header_ptr) - old_size, __ATOMIC_RELAXED);
+
+  return header_ptr;
+
+} // mapped_realloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, without tracing.  Serve a small request
+ * with an object from this thread's cache if there is one, or else from one of
+ * an arena's slabs.  Give a large block its own mapping.  Otherwise, allocate
+ * from an arena.
+ *
+ * A block to be zeroed is cleared only where it might not already be zero.  A
+ * new mapping is zero throughout, and a block bumped from an arena's free
+ * address is zero from the arena's dirty address up, so the pages of a large
+ * zeroed block are first touched only when the program uses them.  A small
+ * object is simply cleared.
+ *
+ * \param size The number of bytes to allocate.
+ * \param zero Whether the block's first `size` bytes must be zero.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static void* heap_malloc (size_t size, bool zero) {
+
+  init();
+
+  // Special case: if the number of bytes to allocate is 0, return NULL.  A
+  // request too large to represent as a block fails outright.
+  if (size == 0) {
+    return NULL;
+  }
+  if (size > PTRDIFF_MAX) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  size_t request = size;
+
+  if (size <= SLAB_MAX) {
+    size_t object_size = ALIGN_SIZE(size);
+    void*  block_ptr   = tcache_get(object_size);
+    if (block_ptr == NULL) {
+      arena_s* arena = arena_lock();
+      block_ptr = slab_malloc(arena, object_size);
+      pthread_mutex_unlock(&arena->lock);
+    }
+    if (zero && block_ptr != NULL) {
+      memset(block_ptr, 0, request);
+    }
+    return block_ptr;
+  }
+
+  size = REQUEST_TO_SIZE(size);
+  if (size >= mmap_threshold || size > REGION_SIZE_MAX) {
+    header_s* header_ptr = mapped_malloc(ALIGNMENT, size);
+    return (header_ptr == NULL) ? NULL : HEADER_TO_BLOCK(header_ptr);
+  }
+
+  // Note where the arena's untouched space begins before allocating from it.  A
+  // block from a new region is untouched throughout.
+  arena_s* arena = arena_lock();
+  arena_init(arena);
+  intptr_t  start_addr = arena->start_addr;
+  intptr_t  free_addr  = arena->free_addr;
+  intptr_t  clean_addr = arena->dirty_addr;
+  header_s* header_ptr = arena_malloc(arena, size);
+  if (arena->start_addr != start_addr) {
+    free_addr  = (intptr_t)header_ptr;
+    clean_addr = (intptr_t)header_ptr;
+  }
+  pthread_mutex_unlock(&arena->lock);
+  if (header_ptr == NULL) {
+    return NULL;
+  }
+
+  void* block_ptr = HEADER_TO_BLOCK(header_ptr);
+  if (zero) {
+    intptr_t dirty_end = (intptr_t)block_ptr + request;
+    if ((intptr_t)header_ptr == free_addr && clean_addr < dirty_end) {
+      dirty_end = clean_addr;
+    }
+    if (dirty_end > (intptr_t)block_ptr) {
+      memset(block_ptr, 0, dirty_end - (intptr_t)block_ptr);
+    }
+  }
+
+  return block_ptr;
+
+} // heap_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc (size_t size) {
+
+  void* block_ptr = heap_malloc(size, false);
+  TRACE(TRACE_MALLOC, block_ptr, size, 0);
+
+  return block_ptr;
+
+} // malloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap, without tracing.  Put a small object
+ * into this thread's cache, or else return it to its slab.  Unmap a block that
+ * has its own mapping.  Otherwise, return the block to its arena, merging it
+ * with its free physical neighbours.  A block from an arena other than this
+ * thread's is instead pushed onto that arena's queue of remote frees, to be
+ * freed by the next thread to allocate from it.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+static void heap_free (void* ptr) {
+
+  // Special case: freeing NULL does nothing.
+  if (ptr == NULL) {
+    return;
+  }
+
+  // A small object has no header; its slab knows its arena, which cannot change
+  // while the object is allocated.
+  if (in_slab_space(ptr)) {
+    if (!tcache_put(ptr)) {
+      arena_s* arena = SLAB_OF(ptr)->arena;
+      if (arena != thread_arena) {
+	remote_push(arena, ptr, ptr);
+	return;
+      }
+      pthread_mutex_lock(&arena->lock);
+      remote_drain(arena);
+      slab_free(arena, ptr);
+      pthread_mutex_unlock(&arena->lock);
+    }
+    return;
+  }
+
+  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+  if (!(header_ptr->size & ALLOCATED)) {
+    ERROR("Double-free: ", (intptr_t)header_ptr);
+  }
+
+  if (header_ptr->size & MAPPED) {
+    __atomic_sub_fetch(&mapped_bytes, SIZE(header_ptr), __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&mapped_blocks, 1, __ATOMIC_RELAXED);
+    munmap(MAPPING_START(header_ptr), MAPPING_LENGTH(header_ptr));
+    return;
+  }
+
+  arena_s* arena = arena_of(ptr);
+  if (arena == NULL) {
+    ERROR("free(): Block outside of the heap: ", (intptr_t)ptr);
+  }
+  if (arena != thread_arena) {
+    remote_push(arena, ptr, ptr);
+    return;
+  }
+  pthread_mutex_lock(&arena->lock);
+  remote_drain(arena);
+  release(arena, header_ptr);
+  pthread_mutex_unlock(&arena->lock);
+
+} // heap_free ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.  The call is traced first, before the
+ * block might be reallocated to another thread.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void free (void* ptr) {
+
+  if (ptr != NULL) {
+    TRACE(TRACE_FREE, ptr, 0, 0);
+  }
+  heap_free(ptr);
+
+} // free()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block of `nmemb * size` bytes on the heap, zeroing its contents
+ * where they are not already zero.
+ *
+ * \param nmemb The number of elements in the new block.
+ * \param size  The size, in bytes, of each of the `nmemb` elements.
+ * \return      A pointer to the newly allocated and zeroed block, if successful;
+ *              `NULL` if unsuccessful (with `errno` set if `nmemb * size`
+ *              overflows).
+ */
+void* calloc (size_t nmemb, size_t size) {
+
+  // Refuse a request whose size cannot be represented.
+  size_t block_size;
+  if (__builtin_mul_overflow(nmemb, size, &block_size)) {
+    errno = ENOMEM;
+    TRACE(TRACE_CALLOC, NULL, SIZE_MAX, 0);
+    return NULL;
+  }
+
+  void* new_block_ptr = heap_malloc(block_size, true);
+  TRACE(TRACE_CALLOC, new_block_ptr, block_size, 0);
+
+  return new_block_ptr;
+  
+} // calloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.  Here, if `size`
+ * fits within the given block, then the block is shrunk in place, releasing
+ * any sizeable tail.  If the `size` is an increase for the block, then the
+ * block is grown in place when it is the topmost block (by bumping the free
+ * address) or when it is followed by a large enough free block.  A block with
+ * its own mapping is remapped instead, and a small object is kept only if the
+ * new size fits in it.  Otherwise, a new block is allocated,
+ * and the data from the old block is copied, the old block freed, and the new
+ * block returned.  Nothing is traced.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+static void* heap_realloc (void* ptr, size_t size) {
+
+  // Special case: If there is no original block, then just allocate the new one
+  // of the given size.
+  if (ptr == NULL) {
+    return heap_malloc(size, false);
+  }
+
+  // Special case: If the new size is 0, that's tantamount to freeing the block.
+  if (size == 0) {
+    heap_free(ptr);
+    return NULL;
   }
-    
+
+  if (size > PTRDIFF_MAX) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  // A small object has no header; its size is its slab's object size.
+  if (in_slab_space(ptr)) {
+    size_t object_size = SLAB_OF(ptr)->object_size;
+    if (size <= object_size) {
+      return ptr;
+    }
+    void* new_block_ptr = heap_malloc(size, false);
+    if (new_block_ptr != NULL) {
+      memcpy(new_block_ptr, ptr, object_size);
+      heap_free(ptr);
+    }
+    return new_block_ptr;
+  }
+
+  size_t    new_size   = REQUEST_TO_SIZE(size);
+  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+  size_t    old_size   = SIZE(header_ptr);
+  size_t    threshold  = mmap_threshold;
+
+  // A block with its own mapping stays in one, moving with the mapping, as long
+  // as it stays large.
+  if (header_ptr->size & MAPPED) {
+    if (new_size >= threshold) {
+      header_ptr = mapped_realloc(header_ptr, new_size);
+      return (header_ptr == NULL) ? NULL : HEADER_TO_BLOCK(header_ptr);
+    }
+  }
+
+  // Otherwise, try to resize the block where it is, unless it should now move
+  // into a mapping of its own.
+  else if (new_size < threshold || new_size <= old_size) {
+    arena_s* arena = arena_of(ptr);
+    if (arena == NULL) {
+      ERROR("realloc(): Block outside of the heap: ", (intptr_t)ptr);
+    }
+    pthread_mutex_lock(&arena->lock);
+    remote_drain(arena);
+    bool resized = arena_resize(arena, header_ptr, new_size);
+    pthread_mutex_unlock(&arena->lock);
+    if (resized) {
+      return ptr;
+    }
+  }
+
+  // The block cannot be resized in place.  Allocate the new block, copy the
+  // contents of the old into it (no more than was asked for, since the new one
+  // may be a small object), and free the old.
+  void*  new_block_ptr = heap_malloc(size, false);
+  size_t usable_size   = old_size - HEADER_SIZE;
+  if (new_block_ptr != NULL) {
+    memcpy(new_block_ptr, ptr, (usable_size < size) ? usable_size : size);
+    heap_free(ptr);
+  }
+
   return new_block_ptr;
-  
+
+} // heap_realloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`, moving it if
+ * necessary.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+void* realloc (void* ptr, size_t size) {
+
+  void* new_block_ptr = heap_realloc(ptr, size);
+  TRACE(TRACE_REALLOC, new_block_ptr, size, ptr);
+
+  return new_block_ptr;
+
 } // realloc()
 // ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, with the block aligned to a multiple of
+ * `alignment`.  Give a large block its own mapping; otherwise, allocate from an
+ * arena.  (The thread cache holds no blocks known to be so aligned.)
+ *
+ * \param alignment The alignment of the block; a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+static void* aligned_malloc (size_t alignment, size_t size) {
+
+  if (alignment <= ALIGNMENT) {
+    return heap_malloc(size, false);
+  }
+
+  init();
+
+  if (size == 0) {
+    return NULL;
+  }
+  if (size > PTRDIFF_MAX || alignment > PTRDIFF_MAX - size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  size = REQUEST_TO_SIZE(size);
+
+  header_s* header_ptr = NULL;
+  if (size >= mmap_threshold || size + alignment > REGION_SIZE_MAX) {
+    header_ptr = mapped_malloc(alignment, size);
+  } else {
+    arena_s* arena = arena_lock();
+    header_ptr = arena_memalign(arena, alignment, size);
+    pthread_mutex_unlock(&arena->lock);
+  }
+
+  return (header_ptr == NULL) ? NULL : HEADER_TO_BLOCK(header_ptr);
+
+} // aligned_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, aligned to a multiple of `alignment`.
+ *
+ * \param memptr    Where to store a pointer to the allocated block.
+ * \param alignment The alignment of the block; a power of two multiple of
+ *                  `sizeof(void*)`.
+ * \param size      The number of bytes to allocate.
+ * \return          0 if successful; `EINVAL` if `alignment` is invalid; `ENOMEM`
+ *                  if there is not enough space.
+ */
+int posix_memalign (void** memptr, size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment) || alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+
+  // Special case: a 0-byte request yields no block, which is not a failure.
+  *memptr = NULL;
+  if (size == 0) {
+    return 0;
+  }
+
+  void* block_ptr = aligned_malloc(alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  if (block_ptr == NULL) {
+    return ENOMEM;
+  }
+  *memptr = block_ptr;
+
+  return 0;
+
+} // posix_memalign ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, aligned to a multiple of `alignment`.
+ *
+ * \param alignment The alignment of the block; a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful (with `errno` set).
+ */
+void* aligned_alloc (size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  void* block_ptr = aligned_malloc(alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  if (block_ptr == NULL && size != 0) {
+    errno = ENOMEM;
+  }
+
+  return block_ptr;
+
+} // aligned_alloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The obsolete form of `aligned_alloc()`.
+ *
+ * \param alignment The alignment of the block; a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* memalign (size_t alignment, size_t size) {
+
+  return aligned_alloc(alignment, size);
+
+} // memalign ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, aligned to a page boundary.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* valloc (size_t size) {
+
+  return aligned_alloc(PAGE_SIZE, size);
+
+} // valloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate whole pages of heap space, enough for `size` bytes, aligned to a page
+ * boundary.  As with glibc, a request for 0 bytes gets one page.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* pvalloc (size_t size) {
+
+  size_t page_size = PAGE_SIZE;
+  if (size > PTRDIFF_MAX) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (size == 0) {
+    size = page_size;
+  }
+
+  return aligned_alloc(page_size, (size + page_size - 1) & ~(page_size - 1));
+
+} // pvalloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Report the number of bytes usable in an allocated block, which may exceed the
+ * number requested, up to the start of the next block.
+ *
+ * \param ptr A pointer to the block; may be `NULL`.
+ * \return    The block's usable size, or 0 if `ptr` is `NULL`.
+ */
+size_t malloc_usable_size (void* ptr) {
+
+  if (ptr == NULL) {
+    return 0;
+  }
+  if (in_slab_space(ptr)) {
+    return SLAB_OF(ptr)->object_size;
+  }
+
+  return USABLE_SIZE(BLOCK_TO_HEADER(ptr));
+
+} // malloc_usable_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate up to `n` blocks of `size` bytes each.  Carve them from runs that are
+ * each allocated from this thread's arena as a single block, so that the arena
+ * is locked, and its bins searched, once per run rather than once per block, and
+ * the blocks of a run lie next to each other.  Small objects are all taken from
+ * the arena's slabs under one locking.  Blocks large enough to get their own
+ * mappings are allocated one at a time.
+ *
+ * \param size The number of bytes in each block.
+ * \param n    The number of blocks to allocate.
+ * \param out  Where to store pointers to the blocks.
+ * \return     The number of blocks allocated, and stored at the start of `out`;
+ *             fewer than `n` only if the heap is exhausted.
+ */
+size_t malloc_batch (size_t size, size_t n, void** out) {
+
+  init();
+
+  if (size == 0) {
+    return 0;
+  }
+  if (size > PTRDIFF_MAX) {
+    errno = ENOMEM;
+    return 0;
+  }
+  size_t block_size = REQUEST_TO_SIZE(size);
+  size_t count      = 0;
+
+  if (size <= SLAB_MAX) {
+
+    arena_s* arena = arena_lock();
+    while (count < n && (out[count] = slab_malloc(arena, ALIGN_SIZE(size))) != NULL) {
+      count += 1;
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+  } else if (block_size >= mmap_threshold || block_size > REGION_SIZE_MAX) {
+
+    while (count < n && (out[count] = heap_malloc(size, false)) != NULL) {
+      count += 1;
+    }
+
+  } else {
+
+    size_t   run_max = (block_size < BATCH_RUN_MAX) ? BATCH_RUN_MAX / block_size : 1;
+    arena_s* arena   = arena_lock();
+    while (count < n) {
+
+      size_t    run        = (n - count < run_max) ? n - count : run_max;
+      header_s* header_ptr = arena_malloc(arena, run * block_size);
+      if (header_ptr == NULL) {
+	break;
+      }
+
+      // The run's first block keeps the run's flags; the rest follow it.  The
+      // last takes any slack too small to have been split off the run.
+      intptr_t run_end = BLOCK_END(header_ptr);
+      header_ptr->size = block_size | (header_ptr->size & FLAGS);
+      out[count]       = HEADER_TO_BLOCK(header_ptr);
+      for (size_t i = 1; i < run; i += 1) {
+	header_ptr       = (header_s*)BLOCK_END(header_ptr);
+	header_ptr->size = block_size | ALLOCATED | PREV_ALLOCATED;
+	out[count + i]   = HEADER_TO_BLOCK(header_ptr);
+      }
+      header_ptr->size = (run_end - (intptr_t)header_ptr) | (header_ptr->size & FLAGS);
+      count += run;
+
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+  }
+
+  for (size_t i = 0; i < count; i += 1) {
+    TRACE(TRACE_MALLOC, out[i], size, 0);
+  }
+
+  return count;
+
+} // malloc_batch ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Free `n` blocks.  Consecutive blocks from this thread's arena share one
+ * locking, and consecutive blocks that also lie next to each other (as those
+ * from one run of `malloc_batch()` do) are released together, as a single
+ * block.  Small objects go straight back to their slabs, bypassing this
+ * thread's cache.  Consecutive blocks from any other arena are pushed onto its
+ * queue of remote frees as one chain, leaving its lock to its own threads.
+ *
+ * \param ptrs The blocks to free; any may be `NULL`.
+ * \param n    The number of blocks.
+ */
+void free_batch (void** ptrs, size_t n) {
+
+  arena_s* locked    = NULL;
+  arena_s* remote    = NULL;
+  void*    first_ptr = NULL;
+  void*    last_ptr  = NULL;
+  for (size_t i = 0; i < n; i += 1) {
+
+    void* ptr = ptrs[i];
+    if (ptr == NULL) {
+      continue;
+    }
+    TRACE(TRACE_FREE, ptr, 0, 0);
+
+    bool      small      = in_slab_space(ptr);
+    header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+    if (!small && !(header_ptr->size & ALLOCATED)) {
+      ERROR("Double-free: ", (intptr_t)header_ptr);
+    }
+    if (!small && (header_ptr->size & MAPPED)) {
+      heap_free(ptr);
+      continue;
+    }
+
+    arena_s* arena = small ? SLAB_OF(ptr)->arena : arena_of(ptr);
+    if (arena == NULL) {
+      ERROR("free_batch(): Block outside of the heap: ", (intptr_t)ptr);
+    }
+    if (arena != thread_arena) {
+      if (arena != remote && remote != NULL) {
+	remote_push(remote, first_ptr, last_ptr);
+	remote = NULL;
+      }
+      if (remote == NULL) {
+	remote    = arena;
+	first_ptr = ptr;
+      } else {
+	REMOTE_NEXT(last_ptr) = ptr;
+      }
+      last_ptr = ptr;
+      continue;
+    }
+    if (locked == NULL) {
+      pthread_mutex_lock(&arena->lock);
+      remote_drain(arena);
+      locked = arena;
+    }
+    if (small) {
+      slab_free(arena, ptr);
+      continue;
+    }
+
+    // Absorb the blocks that follow this one, both in the batch and in memory.
+    while (i + 1 < n && ptrs[i + 1] == HEADER_TO_BLOCK(BLOCK_END(header_ptr))) {
+      i += 1;
+      TRACE(TRACE_FREE, ptrs[i], 0, 0);
+      header_s* next_ptr = BLOCK_TO_HEADER(ptrs[i]);
+      if (!(next_ptr->size & ALLOCATED)) {
+	ERROR("Double-free: ", (intptr_t)next_ptr);
+      }
+      header_ptr->size += SIZE(next_ptr);
+    }
+    release(arena, header_ptr);
+
+  }
+  if (remote != NULL) {
+    remote_push(remote, first_ptr, last_ptr);
+  }
+  if (locked != NULL) {
+    pthread_mutex_unlock(&locked->lock);
+  }
+
+} // free_batch ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return as much free memory to the kernel as possible.  First flush this
+ * thread's cache back to the slabs; then, in every arena, free the blocks in
+ * its queue of remote frees, and release the pages of every large free block
+ * and the touched pages above the free address; and finally release the pages
+ * of every pooled empty slab.
+ *
+ * \param pad The number of bytes above each arena's free address to keep.
+ * \return    1 if any memory was returned to the kernel; 0 otherwise.
+ */
+int malloc_trim (size_t pad) {
+
+  init();
+
+  if (!tcache.dead) {
+    for (size_t i = 0; i < TCACHE_BINS; i += 1) {
+      tcache_flush(i, 0);
+    }
+  }
+
+  size_t released = 0;
+  for (size_t i = 0; i < num_arenas; i += 1) {
+
+    arena_s* arena = &arenas[i];
+    pthread_mutex_lock(&arena->lock);
+    remote_drain(arena);
+    if (arena->start_addr != 0) {
+      released += trim_top(arena, pad);
+      released += trim_tree(arena->tree);
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+  }
+
+  pthread_mutex_lock(&slab_lock);
+  released += slab_trim(0);
+  pthread_mutex_unlock(&slab_lock);
+
+  return released != 0;
+
+} // malloc_trim ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a snapshot of the heap's use, locking each arena in turn (and freeing
+ * the blocks in its queue of remote frees).  The slabs
+ * count towards the heap; the space in them outside of their objects, and in
+ * their free objects, is wasted.  Objects held in thread caches count as in
+ * use.
+ *
+ * \param stats Where to store the snapshot, its `size` set by the caller.
+ */
+void alloc_stats (alloc_stats_s* stats) {
+
+  init();
+
+  alloc_stats_s snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  size_t slab_bytes = 0;
+  for (size_t i = 0; i < num_arenas; i += 1) {
+
+    arena_s* arena = &arenas[i];
+    pthread_mutex_lock(&arena->lock);
+    remote_drain(arena);
+
+    // An arena that has only served small objects has no region of its own, but
+    // its objects are in use all the same.
+    snapshot.in_use_bytes += arena->slab_bytes;
+    slab_bytes            += arena->slab_bytes;
+    if (arena->start_addr != 0) {
+
+      size_t heap_bytes      = (arena->sealed_bytes +
+				arena->free_addr - arena->start_addr - HEADER_OFFSET);
+      snapshot.heap_bytes   += heap_bytes;
+      snapshot.in_use_bytes += heap_bytes - arena->free_bytes;
+      snapshot.free_bytes   += arena->free_bytes;
+      snapshot.free_blocks  += arena->free_blocks;
+      for (size_t j = 0; j < ALLOC_STATS_BUCKETS; j += 1) {
+	snapshot.free_histogram[j] += arena->free_histogram[j];
+      }
+
+      // The largest free block is recorded at the root of a tree ordered by
+      // address, or is the rightmost of one ordered by size, or else lies in
+      // the highest non-empty bin.
+      size_t largest = 0;
+      if (arena->tree != NULL && tree_by_address) {
+	largest = arena->tree->largest;
+      } else if (arena->tree != NULL) {
+	node_s* node = arena->tree;
+	while (node->right != NULL) {
+	  node = node->right;
+	}
+	largest = SIZE(&node->header);
+      } else {
+	for (size_t word = BINMAP_WORDS; word > 0 && largest == 0; word -= 1) {
+	  uint64_t bits = arena->binmap[word - 1];
+	  if (bits != 0) {
+	    largest = ((word - 1) * 64 + 64 - __builtin_clzl(bits)) * ALIGNMENT;
+	  }
+	}
+      }
+      if (snapshot.largest_free < largest) {
+	snapshot.largest_free = largest;
+      }
+
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+  }
+
+  pthread_mutex_lock(&slab_lock);
+  snapshot.heap_bytes  += slab_space_bytes;
+  snapshot.wasted_bytes = (slab_space_bytes > slab_bytes) ? slab_space_bytes - slab_bytes : 0;
+  pthread_mutex_unlock(&slab_lock);
+
+  snapshot.mapped_bytes  = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+  snapshot.mapped_blocks = __atomic_load_n(&mapped_blocks, __ATOMIC_RELAXED);
+  snapshot.policy        = policy_names[policy];
+  if (snapshot.free_bytes != 0) {
+    snapshot.fragmentation = 1.0 - (double)snapshot.largest_free / snapshot.free_bytes;
+  }
+
+  // Fill in only as much of the caller's snapshot as it has room for.
+  size_t size   = (stats->size < sizeof(snapshot)) ? stats->size : sizeof(snapshot);
+  snapshot.size = size;
+  memcpy(stats, &snapshot, size);
+
+} // alloc_stats ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Print a summary of the heap's use to `stderr`, including a histogram of free
+ * block sizes.
+ */
+void malloc_stats (void) {
+
+  alloc_stats_s stats = { .size = sizeof(alloc_stats_s) };
+  alloc_stats(&stats);
+
+  if (policy == POLICY_GOOD) {
+    fprintf(stderr, "policy:          %s (within %zu%%)\n", stats.policy, good_fit_percent);
+  } else {
+    fprintf(stderr, "policy:          %s\n", stats.policy);
+  }
+  fprintf(stderr, "heap bytes:      %zu\n", stats.heap_bytes);
+  fprintf(stderr, "in use bytes:    %zu\n", stats.in_use_bytes);
+  fprintf(stderr, "free bytes:      %zu (%zu blocks)\n", stats.free_bytes, stats.free_blocks);
+  fprintf(stderr, "wasted bytes:    %zu\n", stats.wasted_bytes);
+  fprintf(stderr, "mapped bytes:    %zu (%zu blocks)\n", stats.mapped_bytes, stats.mapped_blocks);
+  fprintf(stderr, "largest free:    %zu\n", stats.largest_free);
+  fprintf(stderr, "fragmentation:   %.3f\n", stats.fragmentation);
+  for (size_t i = 0; i < ALLOC_STATS_BUCKETS; i += 1) {
+    if (stats.free_histogram[i] != 0) {
+      fprintf(stderr, "  free [2^%zu, 2^%zu): %zu\n", i, i + 1, stats.free_histogram[i]);
+    }
+  }
+
+} // malloc_stats ()
+// ==============================================================================
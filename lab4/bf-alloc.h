@@ -0,0 +1,63 @@
+// ==============================================================================
+/**
+ * bf-alloc.h
+ *
+ * The extensions that bf-alloc provides beyond the standard allocation
+ * functions.  A program linked against the allocator (or preloading it) may
+ * declare them through this header; `alloc_stats()` and `malloc_stats()` are
+ * declared in alloc-stats.h, which it includes.
+ **/
+// ==============================================================================
+
+
+
+#if !defined (_BF_ALLOC_H)
+#define _BF_ALLOC_H
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+
+#include "alloc-stats.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FUNCTIONS
+
+/**
+ * Allocate up to `n` blocks of `size` bytes each, locking the heap once per
+ * batch rather than once per block.
+ *
+ * \param size The number of bytes in each block.
+ * \param n    The number of blocks to allocate.
+ * \param out  Where to store pointers to the blocks.
+ * \return     The number of blocks allocated, and stored at the start of `out`;
+ *             fewer than `n` only if the heap is exhausted.
+ */
+size_t malloc_batch (size_t size, size_t n, void** out);
+
+/**
+ * Free `n` blocks, locking the heap once per batch rather than once per block.
+ *
+ * \param ptrs The blocks to free; any may be `NULL`.
+ * \param n    The number of blocks.
+ */
+void free_batch (void** ptrs, size_t n);
+
+/**
+ * Return as much free memory to the kernel as possible.
+ *
+ * \param pad The number of bytes above each arena's free address to keep.
+ * \return    1 if any memory was returned to the kernel; 0 otherwise.
+ */
+int malloc_trim (size_t pad);
+// ==============================================================================
+
+
+
+#endif // _BF_ALLOC_H
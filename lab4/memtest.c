@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bf-alloc.h"
+
+//another allocator does not provide the batch functions, which are then NULL
+#pragma weak malloc_batch
+#pragma weak free_batch
+#pragma weak alloc_stats
+
+//the number of checks that failed
+static int failures = 0;
+
+//report one check, and count it if it failed
+static void check (bool ok, const char* what){
+  if(ok){
+    printf("%s works properly\n", what);
+  }
+  else{
+    printf("%s failed\n", what);
+    failures += 1;
+  }
+}
+
+//allocate through every member of the aligned family, at alignments from 32
+//bytes to a page and sizes from tiny to large enough for a mapping of its own
+//(or larger than a thread's chunk), checking each block's alignment and usable
+//size, and writing all of it
+static void check_aligned (void){
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t sizes[] = { 1, 100, 5000, 300000 };
+  bool aligned = true;
+  bool usable = true;
+  for(size_t alignment = 32; alignment <= page; alignment *= 2){
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+      size_t size = sizes[i];
+      void* blocks[5];
+      size_t wanted[5] = { alignment, alignment, alignment, page, page };
+      if(posix_memalign(&blocks[0], alignment, size) != 0){
+        blocks[0] = NULL;
+      }
+      blocks[1] = aligned_alloc(alignment, size);
+      blocks[2] = memalign(alignment, size);
+      blocks[3] = valloc(size);
+      blocks[4] = pvalloc(size);
+      for(int j = 0; j < 5; j++){
+        size_t need = (j == 4) ? (size + page - 1) & ~(page - 1) : size;
+        aligned &= blocks[j] != NULL && (uintptr_t)blocks[j] % wanted[j] == 0;
+        usable &= blocks[j] != NULL && malloc_usable_size(blocks[j]) >= need;
+        if(blocks[j] != NULL){
+          memset(blocks[j], 0x5a, malloc_usable_size(blocks[j]));
+        }
+      }
+      for(int j = 0; j < 5; j++){
+        free(blocks[j]);
+      }
+    }
+  }
+  check(aligned, "Aligned allocation");
+  check(usable, "malloc_usable_size of aligned blocks");
+
+  //pvalloc of nothing still gets a whole page, as with glibc
+  void* empty = pvalloc(0);
+  check(empty != NULL && (uintptr_t)empty % page == 0 && malloc_usable_size(empty) >= page,
+        "pvalloc(0)");
+  free(empty);
+
+  //a request too large to represent fails with ENOMEM
+  volatile size_t huge = (size_t)PTRDIFF_MAX + 1;
+  void* block;
+  errno = 0;
+  bool refused = malloc(huge) == NULL && errno == ENOMEM;
+  errno = 0;
+  refused &= memalign(64, huge) == NULL && errno == ENOMEM;
+  refused &= posix_memalign(&block, 64, huge) == ENOMEM;
+  check(refused, "Refusing oversized requests");
+}
+
+//the blocks that a thread allocates for another to free
+#define BATCH 100
+static void* batch[BATCH];
+
+//allocate a batch on a thread of its own, and so from another arena
+static void* allocate_batch (void* arg){
+  *(size_t*)arg = malloc_batch(200, BATCH, batch);
+  return NULL;
+}
+
+//allocate batches of small, medium and mapped blocks, fill each block, check
+//that none overlap, and free them as a batch, with gaps, out of order, and on
+//another thread than allocated them
+static void check_batch (void){
+  if(malloc_batch == NULL || free_batch == NULL){
+    printf("Batch allocation is not provided\n");
+    return;
+  }
+  size_t sizes[] = { 24, 200, 3000, 600000 };
+  bool filled = true;
+  for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+    size_t size = sizes[i];
+    size_t count = malloc_batch(size, BATCH, batch);
+    filled &= count == BATCH;
+    for(size_t j = 0; j < count; j++){
+      filled &= (uintptr_t)batch[j] % 16 == 0 && malloc_usable_size(batch[j]) >= size;
+      memset(batch[j], (int)j, size);
+    }
+    for(size_t j = 0; j < count; j++){
+      const unsigned char* bytes = batch[j];
+      filled &= bytes[0] == (unsigned char)j && bytes[size - 1] == (unsigned char)j;
+    }
+
+    //free every other block alone, and the rest, reversed, in one batch
+    for(size_t j = 0; j < count; j += 2){
+      free(batch[j]);
+      batch[j] = NULL;
+    }
+    for(size_t j = 0; j < count / 2; j++){
+      void* swap = batch[j];
+      batch[j] = batch[count - 1 - j];
+      batch[count - 1 - j] = swap;
+    }
+    free_batch(batch, count);
+  }
+  check(filled, "malloc_batch/free_batch");
+
+  //free a run of neighbouring blocks in the order allocated, behind a block
+  //that keeps it off the top of the heap, so that free_batch absorbs the run
+  //into one free block that a single request can then take whole
+  alloc_stats_s freed = { .size = sizeof(alloc_stats_s) };
+  alloc_stats_s absorbed = { .size = sizeof(alloc_stats_s) };
+  size_t run = malloc_batch(3000, 64, batch);
+  void* pin = malloc(3000);
+  if(alloc_stats != NULL){
+    alloc_stats(&freed);
+  }
+  free_batch(batch, run);
+  bool merged = run == 64;
+  if(alloc_stats != NULL){
+    alloc_stats(&absorbed);
+    merged &= absorbed.free_bytes - freed.free_bytes >= run * 3000;
+    merged &= absorbed.largest_free >= run * 3000;
+  }
+  void* whole = malloc(run * 3000);
+  merged &= whole != NULL;
+  if(whole != NULL){
+    memset(whole, 0x5a, run * 3000);
+  }
+  free(whole);
+  free(pin);
+  check(merged, "free_batch of neighbouring blocks");
+
+  //the blocks freed here belong to the other thread's arena, and are freed in
+  //full once a snapshot has drained its queue of remote frees
+  alloc_stats_s before = { .size = sizeof(alloc_stats_s) };
+  alloc_stats_s after = { .size = sizeof(alloc_stats_s) };
+  size_t count = 0;
+  pthread_t thread;
+  pthread_create(&thread, NULL, allocate_batch, &count);
+  pthread_join(thread, NULL);
+  if(alloc_stats != NULL){
+    alloc_stats(&before);
+  }
+  free_batch(batch, count);
+  if(alloc_stats != NULL){
+    alloc_stats(&after);
+  }
+  check(count == BATCH && before.in_use_bytes - after.in_use_bytes >= BATCH * 200,
+        "free_batch across threads");
+}
+
+//the resident size of this process, in bytes
+static size_t resident_bytes (void){
+  size_t pages = 0;
+  size_t resident = 0;
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if(statm != NULL){
+    if(fscanf(statm, "%zu %zu", &pages, &resident) != 2){
+      resident = 0;
+    }
+    fclose(statm);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+//free enough heap blocks to pass the trim threshold, behind a block that keeps
+//them off the top of the heap, and check that their pages go back to the
+//kernel while the blocks on either side of the freed space keep their contents
+#define TRIM_BLOCKS 128
+#define TRIM_SIZE 65536
+static void check_trim (void){
+  alloc_stats_s stats = { .size = sizeof(alloc_stats_s) };
+  if(alloc_stats != NULL){
+    alloc_stats(&stats);
+  }
+  if(stats.policy != NULL && strcmp(stats.policy, "bump") == 0){
+    printf("Trimming is not provided\n");
+    return;
+  }
+
+  void* blocks[TRIM_BLOCKS];
+  char* before = malloc(5000);
+  for(int i = 0; i < TRIM_BLOCKS; i++){
+    blocks[i] = malloc(TRIM_SIZE);
+    if(blocks[i] != NULL){
+      memset(blocks[i], 0x5a, TRIM_SIZE);
+    }
+  }
+  char* after = malloc(5000);
+  bool kept = before != NULL && after != NULL;
+  if(kept){
+    memset(before, 0x11, 5000);
+    memset(after, 0x22, 5000);
+  }
+
+  size_t full = resident_bytes();
+  for(int i = 0; i < TRIM_BLOCKS; i++){
+    free(blocks[i]);
+  }
+  size_t trimmed = resident_bytes();
+  check(full - trimmed >= TRIM_BLOCKS * TRIM_SIZE / 2, "Returning freed pages");
+
+  for(int i = 0; kept && i < 5000; i++){
+    kept = before[i] == 0x11 && after[i] == 0x22;
+  }
+  check(kept, "Keeping the neighbours of trimmed space");
+  free(before);
+  free(after);
+}
+
+int main (void){
+
+  //Initial memory allocation
+  char* x=malloc(24);
+  for(int i =0;i<24;i++){
+    x[i]=2*i;
+  }
+  // Reallocating memory
+  char* a = (char*)realloc(x,48);
+ 
+  for(int i =0;i<24;i++){
+    printf("%d ", a[i]);
+     if((int)a[i]!=(int)x[i]){
+       printf("\nRealloc failed\n");
+     }
+     else if (i==23){
+       printf("\nRealloc works properly\n");
+     }
+  }
+  printf("\n The elements of x are:          ");
+  for(int i=0;i<24;i++){
+    printf("%d ",x[i]);
+  }
+   printf("\n The first 24 elements of a are: ");
+    for(int i =0;i<24;i++){
+      printf("%d ", a[i]);}
+
+  
+  char* y = malloc(19);
+  char* z = malloc(32);
+  
+ printf("\n\nx = %p\n", x);
+ if((*x) % 16==0){
+    printf("x is double-word aligned\n");
+  }
+
+  
+  else{
+     printf("x is not double-word aligned\n");
+  }
+
+ 
+  printf("\ny = %p\n", y);
+
+  if((*y) % 16==0){
+    printf(" y is double-word aligned\n");
+  }
+  else{
+     printf(" y is not double-word aligned\n");
+  }
+
+  
+  printf("\nz = %p\n", z);
+
+
+  if((*z) % 16==0){
+    printf(" z is double-word aligned\n");
+  }
+  else{
+     printf(" z is not double-word aligned\n");
+  }
+
+  printf("\n");
+  check_aligned();
+  check_batch();
+  check_trim();
+
+  return failures != 0;
+}
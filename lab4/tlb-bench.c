@@ -0,0 +1,222 @@
+// ==============================================================================
+/**
+ * tlb-bench.c
+ *
+ * A benchmark of the translation lookaside buffer's hold on the heap.  It
+ * allocates many small nodes, links them into a single cycle in random order,
+ * and then chases pointers around the cycle, so that nearly every hop lands on
+ * a different page.  It reports the time per hop, the data TLB misses per hop
+ * (from the hardware counters, where the kernel allows them to be read), and
+ * how much of the heap ended up in transparent huge pages.  Run it against an
+ * allocator with `LD_PRELOAD`, with and without huge pages (see the Makefile):
+ *
+ *   LD_PRELOAD=./bf-alloc.so ./tlb-bench
+ *   BF_ALLOC_HUGEPAGES=thp LD_PRELOAD=./bf-alloc.so ./tlb-bench
+ *
+ *   ./tlb-bench [-n nodes] [-h hops]
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACROS AND CONSTANTS
+
+/** The default number of nodes: 4 M nodes of 64 bytes make a 256 MB heap. */
+#define DEFAULT_NODES (4 * 1024 * 1024)
+
+/** The default number of timed hops. */
+#define DEFAULT_HOPS  (16 * 1024 * 1024)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A node in the cycle, padded to a cache line. */
+typedef struct node {
+
+  /** The next node in the cycle. */
+  struct node* next;
+
+  /** Padding. */
+  char         payload[56];
+
+} node_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the current time in nanoseconds.
+ */
+static double now_ns (void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+
+} // now_ns ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Open a counter of this thread's data TLB read misses, disabled.
+ *
+ * \return The counter's file descriptor, or -1 if the kernel will not allow it.
+ */
+static int open_counter (void) {
+
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HW_CACHE;
+  attr.config         = (PERF_COUNT_HW_CACHE_DTLB |
+			 PERF_COUNT_HW_CACHE_OP_READ << 8 |
+			 PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled       = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+} // open_counter ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find how much of this process's anonymous memory is in transparent huge
+ * pages.
+ *
+ * \return The amount, in kilobytes, or -1 if it cannot be found.
+ */
+static long huge_kb (void) {
+
+  FILE* smaps = fopen("/proc/self/smaps_rollup", "r");
+  if (smaps == NULL) {
+    return -1;
+  }
+
+  char line[256];
+  long kb = -1;
+  while (fgets(line, sizeof(line), smaps) != NULL) {
+    if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+      break;
+    }
+  }
+  fclose(smaps);
+
+  return kb;
+
+} // huge_kb ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+int main (int argc, char** argv) {
+
+  size_t count = DEFAULT_NODES;
+  size_t hops  = DEFAULT_HOPS;
+  int    option;
+  while ((option = getopt(argc, argv, "n:h:")) != -1) {
+    switch (option) {
+    case 'n':
+      count = strtoul(optarg, NULL, 10);
+      break;
+    case 'h':
+      hops = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n nodes] [-h hops]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (count < 2) {
+    count = 2;
+  }
+
+  // Allocate the nodes, then link them in a random order.
+  node_s** nodes = malloc(count * sizeof(node_s*));
+  if (nodes == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  for (size_t i = 0; i < count; i += 1) {
+    nodes[i] = malloc(sizeof(node_s));
+    if (nodes[i] == NULL) {
+      perror("malloc");
+      return 1;
+    }
+  }
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (size_t i = count - 1; i > 0; i -= 1) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    size_t  j = state % (i + 1);
+    node_s* t = nodes[i];
+    nodes[i]  = nodes[j];
+    nodes[j]  = t;
+  }
+  for (size_t i = 0; i < count; i += 1) {
+    nodes[i]->next = nodes[(i + 1) % count];
+  }
+
+  // Chase the pointers, counting TLB misses if possible.
+  int counter = open_counter();
+  if (counter != -1) {
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  double           start = now_ns();
+  node_s* volatile node  = nodes[0];
+  for (size_t i = 0; i < hops; i += 1) {
+    node = node->next;
+  }
+  double end = now_ns();
+  long long misses = -1;
+  if (counter != -1) {
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+      misses = -1;
+    }
+    close(counter);
+  }
+
+  printf("nodes          %zu (%zu MB)\n", count, count * sizeof(node_s) >> 20);
+  printf("ns per hop     %.2f\n", (end - start) / hops);
+  if (misses >= 0) {
+    printf("dTLB misses    %.3f per hop\n", (double)misses / hops);
+  } else {
+    printf("dTLB misses    unavailable\n");
+  }
+  printf("huge pages     %ld kB\n", huge_kb());
+
+  return 0;
+
+} // main ()
+// ==============================================================================
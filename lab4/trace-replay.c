@@ -0,0 +1,749 @@
+// ==============================================================================
+/**
+ * trace-replay.c
+ *
+ * A benchmark that replays an allocation trace against several allocators and
+ * compares them.  The trace is either a file recorded by setting
+ * `BF_ALLOC_TRACE` or `PB_ALLOC_TRACE` (see alloc-trace.h), or a synthetic one
+ * with power-law sizes.  Each allocator is either `system` (the C library's
+ * own) or a shared library built from one of the allocators, which is loaded
+ * with `dlopen()` and called through the functions that it defines:
+ *
+ *   gcc -O2 -fPIC -shared -o bf-alloc.so bf-alloc.c safeio.c -lpthread
+ *   gcc -O2 -fPIC -shared -o pb-alloc.so ../lab3/pb-alloc.c safeio.c -lpthread
+ *   gcc -O2 -o trace-replay trace-replay.c -ldl -lm
+ *   ./trace-replay trace.bin system ../lab3/pb-alloc.so ./bf-alloc.so
+ *   ./trace-replay -s 1000000 system ./bf-alloc.so
+ *
+ * The records are replayed in order, on one thread.  Each allocator is run in
+ * a fresh child process, twice: once untimed, for its throughput and its peak
+ * resident set size and page faults, and once timing every call, for the
+ * latency percentiles.
+ * Every page of each block is touched as it is allocated.  Fragmentation is
+ * reported as the fraction of the peak resident set that the peak of live
+ * requested bytes did not account for.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define TRACE_FORMAT_ONLY
+#include "alloc-trace.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The smallest and largest sizes in a synthetic trace. */
+#define SYNTHETIC_MIN 16
+#define SYNTHETIC_MAX (1024 * 1024)
+
+/** The exponent of the power law from which synthetic sizes are drawn. */
+#define SYNTHETIC_ALPHA 1.2
+
+/** The value that marks an operation as having no (old) block. */
+#define NO_SLOT UINT32_MAX
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/**
+ * An operation to replay.  Blocks are named by _slots_, numbered in order of
+ * allocation, rather than by address.
+ */
+typedef struct op {
+
+  /** The call, as a `trace_op_e`. */
+  uint32_t op;
+
+  /** The slot of the block allocated, or freed. */
+  uint32_t slot;
+
+  /** For `realloc()`, the slot of the block passed in. */
+  uint32_t old_slot;
+
+  /** For an aligned call, the base-2 logarithm of the alignment. */
+  uint32_t align_log;
+
+  /** The number of bytes requested. */
+  uint64_t size;
+
+} op_s;
+
+/** The functions of an allocator under test. */
+typedef struct allocator {
+
+  void* (*malloc)         (size_t);
+  void  (*free)           (void*);
+  void* (*calloc)         (size_t, size_t);
+  void* (*realloc)        (void*, size_t);
+  int   (*posix_memalign) (void**, size_t, size_t);
+
+} allocator_s;
+
+/** The results of replaying a trace against an allocator. */
+typedef struct result {
+
+  /** The number of operations per second, untimed. */
+  double ops_per_sec;
+
+  /** The number of allocations that failed. */
+  size_t failures;
+
+  /** The growth of the resident set at its peak, in bytes. */
+  size_t peak_rss;
+
+  /** The number of page faults taken. */
+  size_t faults;
+
+  /** The latency percentiles, in nanoseconds. */
+  double p50, p90, p99, p999, max;
+
+} result_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The operations to replay. */
+static op_s*    ops       = NULL;
+static size_t   num_ops   = 0;
+
+/** The number of slots that the operations use. */
+static size_t   num_slots = 0;
+
+/** The peak of the bytes requested and not yet freed. */
+static size_t   peak_live = 0;
+
+/** The state of the pseudo-random number generator. */
+static uint64_t rng_state = 88172645463325252ULL;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Append an operation to the list, growing it as needed.
+ *
+ * \param op The operation.
+ */
+static void add_op (op_s op) {
+
+  static size_t capacity = 0;
+  if (num_ops == capacity) {
+    capacity = (capacity == 0) ? 1024 : capacity * 2;
+    ops      = realloc(ops, capacity * sizeof(op_s));
+    if (ops == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  ops[num_ops] = op;
+  num_ops     += 1;
+
+} // add_op ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Draw a pseudo-random number (xorshift64).
+ *
+ * \return The number.
+ */
+static uint64_t rng () {
+
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+
+} // rng ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read the monotonic clock.
+ *
+ * \return The current time, in nanoseconds.
+ */
+static uint64_t now_ns () {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+} // now_ns ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Build a synthetic trace: allocations (some zeroed, some aligned) with sizes
+ * drawn from a power law, interleaved with frees and reallocations of random
+ * live blocks, and finally freeing everything.
+ *
+ * \param count The number of operations to generate before the final frees.
+ */
+static void synthesize (size_t count) {
+
+  uint32_t* live      = malloc(count * sizeof(uint32_t));
+  size_t    num_live  = 0;
+  if (live == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < count; i += 1) {
+
+    uint64_t roll = rng() % 100;
+    op_s     op   = { TRACE_MALLOC, NO_SLOT, NO_SLOT, 0, 0 };
+
+    if (num_live == 0 || roll < 50) {
+      double u = (rng() >> 11) * (1.0 / 9007199254740992.0) + 1e-12;
+      double s = SYNTHETIC_MIN * pow(u, -1.0 / SYNTHETIC_ALPHA);
+      op.size  = (s > SYNTHETIC_MAX) ? SYNTHETIC_MAX : (uint64_t)s;
+      op.slot  = num_slots++;
+      if (roll < 5) {
+	op.op = TRACE_CALLOC;
+      } else if (roll < 7) {
+	op.op        = TRACE_MEMALIGN;
+	op.align_log = 5 + rng() % 8;
+      }
+      live[num_live++] = op.slot;
+    } else {
+      size_t j = rng() % num_live;
+      if (roll < 60) {
+	op.op       = TRACE_REALLOC;
+	op.old_slot = live[j];
+	op.slot     = num_slots++;
+	op.size     = SYNTHETIC_MIN + rng() % (SYNTHETIC_MAX / 16);
+	live[j]     = op.slot;
+      } else {
+	op.op         = TRACE_FREE;
+	op.slot       = live[j];
+	live[j]       = live[--num_live];
+      }
+    }
+    add_op(op);
+
+  }
+
+  while (num_live > 0) {
+    op_s op = { TRACE_FREE, live[--num_live], NO_SLOT, 0, 0 };
+    add_op(op);
+  }
+  free(live);
+
+} // synthesize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Load a recorded trace, translating addresses into slots.  A free of an
+ * address that was never allocated within the trace (e.g., before recording
+ * began) is dropped; an allocation at an address that is still live implies the
+ * free of the earlier block, whose record was simply claimed later.
+ *
+ * \param path The name of the trace file.
+ */
+static void load (const char* path) {
+
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    exit(1);
+  }
+  trace_header_s header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != TRACE_VERSION ||
+      header.record_size != sizeof(trace_record_s)) {
+    fprintf(stderr, "%s: not a trace file\n", path);
+    exit(1);
+  }
+
+  // Map live addresses to slots in an open-addressed hash table.
+  size_t    capacity = 1 << 20;
+  size_t    used     = 0;
+  uint64_t* keys     = calloc(capacity, sizeof(uint64_t));
+  uint32_t* values   = calloc(capacity, sizeof(uint32_t));
+  if (keys == NULL || values == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+
+  trace_record_s record;
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+
+    // Grow the table (by rebuilding it) when it is half full.
+    if (used * 2 >= capacity) {
+      size_t    new_capacity = capacity * 2;
+      uint64_t* new_keys     = calloc(new_capacity, sizeof(uint64_t));
+      uint32_t* new_values   = calloc(new_capacity, sizeof(uint32_t));
+      if (new_keys == NULL || new_values == NULL) {
+	perror("calloc");
+	exit(1);
+      }
+      used = 0;
+      for (size_t i = 0; i < capacity; i += 1) {
+	if (keys[i] != 0 && values[i] != NO_SLOT) {
+	  size_t h = (keys[i] * 0x9e3779b97f4a7c15ULL) >> 20 & (new_capacity - 1);
+	  while (new_keys[h] != 0) {
+	    h = (h + 1) & (new_capacity - 1);
+	  }
+	  new_keys[h]   = keys[i];
+	  new_values[h] = values[i];
+	  used         += 1;
+	}
+      }
+      free(keys);
+      free(values);
+      keys     = new_keys;
+      values   = new_values;
+      capacity = new_capacity;
+    }
+
+    // Remove an address from the table (leaving a tombstone), and report its
+    // slot.
+#define TAKE(address, result)						\
+    do {								\
+      (result) = NO_SLOT;						\
+      size_t h = ((address) * 0x9e3779b97f4a7c15ULL) >> 20 & (capacity - 1); \
+      while (keys[h] != 0) {						\
+	if (keys[h] == (address) && values[h] != NO_SLOT) {		\
+	  (result)  = values[h];					\
+	  values[h] = NO_SLOT;						\
+	  break;							\
+	}								\
+	h = (h + 1) & (capacity - 1);					\
+      }									\
+    } while (0)
+
+    // Add an address to the table, with a new slot.
+#define PUT(address, slot)						\
+    do {								\
+      size_t h = ((address) * 0x9e3779b97f4a7c15ULL) >> 20 & (capacity - 1); \
+      while (keys[h] != 0) {						\
+	h = (h + 1) & (capacity - 1);					\
+      }									\
+      keys[h]   = (address);						\
+      values[h] = (slot);						\
+      used     += 1;							\
+    } while (0)
+
+    op_s     op = { record.op, NO_SLOT, NO_SLOT, 0, record.size };
+    uint32_t stale;
+    switch (record.op) {
+
+    case TRACE_FREE:
+      TAKE(record.addr, op.slot);
+      if (op.slot == NO_SLOT) {
+	continue;
+      }
+      break;
+
+    case TRACE_REALLOC:
+      if (record.arg != 0) {
+	TAKE(record.arg, op.old_slot);
+      }
+      if (op.old_slot == NO_SLOT) {
+	op.op = TRACE_MALLOC;
+      }
+      // fall through
+
+    default:
+      if (record.op == TRACE_MEMALIGN) {
+	op.align_log = (record.arg < 8) ? 3 : 63 - __builtin_clzl(record.arg);
+      }
+
+      // A failed call allocated nothing; a reallocation to 0 bytes freed.
+      if (record.addr == 0) {
+	if (op.op != TRACE_REALLOC || record.size != 0) {
+	  continue;
+	}
+	op.op       = TRACE_FREE;
+	op.slot     = op.old_slot;
+	op.old_slot = NO_SLOT;
+	break;
+      }
+      TAKE(record.addr, stale);
+      if (stale != NO_SLOT) {
+	op_s implied = { TRACE_FREE, stale, NO_SLOT, 0, 0 };
+	add_op(implied);
+      }
+      op.slot = num_slots++;
+      PUT(record.addr, op.slot);
+      break;
+
+    }
+    add_op(op);
+
+#undef TAKE
+#undef PUT
+  }
+
+  // Free whatever the trace left live, so that every replay ends empty.
+  for (size_t i = 0; i < capacity; i += 1) {
+    if (keys[i] != 0 && values[i] != NO_SLOT) {
+      op_s op = { TRACE_FREE, values[i], NO_SLOT, 0, 0 };
+      add_op(op);
+    }
+  }
+
+  free(keys);
+  free(values);
+  fclose(file);
+
+} // load ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Compute the peak of the bytes requested and not yet freed, over the trace.
+ */
+static void measure_live () {
+
+  uint64_t* sizes = calloc(num_slots, sizeof(uint64_t));
+  if (sizes == NULL && num_slots != 0) {
+    perror("calloc");
+    exit(1);
+  }
+
+  size_t live = 0;
+  for (size_t i = 0; i < num_ops; i += 1) {
+    op_s* op = &ops[i];
+    if (op->old_slot != NO_SLOT) {
+      live -= sizes[op->old_slot];
+    }
+    if (op->op == TRACE_FREE) {
+      live -= sizes[op->slot];
+    } else {
+      sizes[op->slot] = op->size;
+      live           += op->size;
+    }
+    if (peak_live < live) {
+      peak_live = live;
+    }
+  }
+
+  free(sizes);
+
+} // measure_live ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the functions of an allocator: the C library's own, or those defined by
+ * a shared library.
+ *
+ * \param name      `system`, or the path of the shared library.
+ * \param allocator Where to store the functions.
+ */
+static void load_allocator (const char* name, allocator_s* allocator) {
+
+  if (strcmp(name, "system") == 0) {
+    allocator->malloc         = malloc;
+    allocator->free           = free;
+    allocator->calloc         = calloc;
+    allocator->realloc        = realloc;
+    allocator->posix_memalign = posix_memalign;
+    return;
+  }
+
+  void* library = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+  if (library == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(1);
+  }
+  allocator->malloc         = (void* (*)(size_t))dlsym(library, "malloc");
+  allocator->free           = (void (*)(void*))dlsym(library, "free");
+  allocator->calloc         = (void* (*)(size_t, size_t))dlsym(library, "calloc");
+  allocator->realloc        = (void* (*)(void*, size_t))dlsym(library, "realloc");
+  allocator->posix_memalign = (int (*)(void**, size_t, size_t))dlsym(library, "posix_memalign");
+  if (allocator->malloc == NULL || allocator->free == NULL ||
+      allocator->calloc == NULL || allocator->realloc == NULL) {
+    fprintf(stderr, "%s: missing allocation functions\n", name);
+    exit(1);
+  }
+
+} // load_allocator ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read a field, in kilobytes, from this process's status.
+ *
+ * \param field The name of the field, with its colon.
+ * \return      The field's value, in bytes.
+ */
+static size_t read_status (const char* field) {
+
+  char  line[256];
+  FILE* file  = fopen("/proc/self/status", "r");
+  size_t value = 0;
+  if (file == NULL) {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, field, strlen(field)) == 0) {
+      value = strtoul(line + strlen(field), NULL, 10) * 1024;
+      break;
+    }
+  }
+  fclose(file);
+
+  return value;
+
+} // read_status ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Replay the trace against an allocator.
+ *
+ * \param allocator The allocator.
+ * \param slots     The blocks, by slot.
+ * \param latencies Where to store the latency of each operation, in
+ *                  nanoseconds; `NULL` not to time operations.
+ * \return          The number of allocations that failed.
+ */
+static size_t replay (allocator_s* allocator, void** slots, uint32_t* latencies) {
+
+  size_t failures = 0;
+  for (size_t i = 0; i < num_ops; i += 1) {
+
+    op_s*    op    = &ops[i];
+    uint64_t start = (latencies != NULL) ? now_ns() : 0;
+    void*    block = NULL;
+
+    switch (op->op) {
+    case TRACE_FREE:
+      allocator->free(slots[op->slot]);
+      break;
+    case TRACE_CALLOC:
+      block = allocator->calloc(1, op->size);
+      break;
+    case TRACE_REALLOC:
+      block = allocator->realloc(slots[op->old_slot], op->size);
+      break;
+    case TRACE_MEMALIGN:
+      if (allocator->posix_memalign == NULL ||
+	  allocator->posix_memalign(&block, (size_t)1 << op->align_log, op->size) != 0) {
+	block = NULL;
+      }
+      break;
+    default:
+      block = allocator->malloc(op->size);
+      break;
+    }
+
+    if (latencies != NULL) {
+      latencies[i] = now_ns() - start;
+    }
+    if (op->op != TRACE_FREE) {
+      slots[op->slot] = block;
+      if (block == NULL && op->size != 0) {
+	failures += 1;
+      } else if (block != NULL) {
+	// Touch every page, as the program that made the trace presumably did.
+	for (size_t offset = 0; offset < op->size; offset += 4096) {
+	  ((volatile char*)block)[offset] = 0;
+	}
+      }
+    }
+
+  }
+
+  return failures;
+
+} // replay ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Compare two latencies, for `qsort()`.
+ */
+static int compare_latencies (const void* a, const void* b) {
+
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return (x > y) - (x < y);
+
+} // compare_latencies ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Run one replay of the trace in a child process, against a freshly loaded
+ * allocator.
+ *
+ * \param name   The allocator, as for `load_allocator()`.
+ * \param timed  Whether to time each operation.
+ * \param result Where to store what the replay measured.
+ */
+static void run_child (const char* name, bool timed, result_s* result) {
+
+  int channel[2];
+  if (pipe(channel) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+
+    close(channel[0]);
+    allocator_s allocator;
+    load_allocator(name, &allocator);
+
+    // Touch all of the harness's own memory before taking the baseline.
+    void**    slots     = calloc(num_slots + 1, sizeof(void*));
+    uint32_t* latencies = timed ? calloc(num_ops + 1, sizeof(uint32_t)) : NULL;
+    memset(slots, 0, (num_slots + 1) * sizeof(void*));
+    if (latencies != NULL) {
+      memset(latencies, 0, (num_ops + 1) * sizeof(uint32_t));
+    }
+    int clear = open("/proc/self/clear_refs", O_WRONLY);
+    if (clear != -1) {
+      if (write(clear, "5", 1) != 1) {
+	perror("clear_refs");
+      }
+      close(clear);
+    }
+    size_t baseline = read_status("VmRSS:");
+
+    result_s child;
+    memset(&child, 0, sizeof(child));
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    child.faults      = usage.ru_minflt + usage.ru_majflt;
+    uint64_t start    = now_ns();
+    child.failures    = replay(&allocator, slots, latencies);
+    uint64_t elapsed  = now_ns() - start;
+    getrusage(RUSAGE_SELF, &usage);
+    child.faults      = usage.ru_minflt + usage.ru_majflt - child.faults;
+    child.ops_per_sec = num_ops / (elapsed / 1e9);
+    size_t peak       = read_status("VmHWM:");
+    child.peak_rss    = (peak > baseline) ? peak - baseline : 0;
+
+    if (latencies != NULL && num_ops > 0) {
+      qsort(latencies, num_ops, sizeof(uint32_t), compare_latencies);
+      child.p50  = latencies[num_ops * 50 / 100];
+      child.p90  = latencies[num_ops * 90 / 100];
+      child.p99  = latencies[num_ops * 99 / 100];
+      child.p999 = latencies[num_ops * 999 / 1000];
+      child.max  = latencies[num_ops - 1];
+    }
+
+    if (write(channel[1], &child, sizeof(child)) != sizeof(child)) {
+      _exit(1);
+    }
+    _exit(0);
+
+  }
+
+  close(channel[1]);
+  int status;
+  if (read(channel[0], result, sizeof(*result)) != sizeof(*result)) {
+    fprintf(stderr, "%s: replay failed\n", name);
+    memset(result, 0, sizeof(*result));
+  }
+  close(channel[0]);
+  waitpid(pid, &status, 0);
+
+} // run_child ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+int main (int argc, char** argv) {
+
+  if (argc < 3 || (strcmp(argv[1], "-s") == 0 && argc < 4)) {
+    fprintf(stderr,
+	    "usage: %s <trace> <allocator>...\n"
+	    "       %s -s <operations> <allocator>...\n"
+	    "where an allocator is `system' or the path of a shared library\n",
+	    argv[0], argv[0]);
+    return 1;
+  }
+
+  int first = 2;
+  if (strcmp(argv[1], "-s") == 0) {
+    synthesize(strtoul(argv[2], NULL, 10));
+    first = 3;
+  } else {
+    load(argv[1]);
+  }
+  measure_live();
+
+  printf("%zu operations, %zu blocks, peak live %zu KB\n\n", num_ops, num_slots, peak_live / 1024);
+  printf("%-24s %12s %8s %8s %8s %8s %10s %12s %6s %10s %8s\n",
+	 "allocator", "ops/s", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns",
+	 "peak RSS KB", "frag", "faults", "failed");
+  for (int i = first; i < argc; i += 1) {
+
+    result_s throughput;
+    result_s latency;
+    run_child(argv[i], false, &throughput);
+    run_child(argv[i], true, &latency);
+
+    double fragmentation = 0;
+    if (throughput.peak_rss > peak_live) {
+      fragmentation = 1.0 - (double)peak_live / throughput.peak_rss;
+    }
+    printf("%-24s %12.0f %8.0f %8.0f %8.0f %8.0f %10.0f %12zu %6.3f %10zu %8zu\n",
+	   argv[i], throughput.ops_per_sec,
+	   latency.p50, latency.p90, latency.p99, latency.p999, latency.max,
+	   throughput.peak_rss / 1024, fragmentation, throughput.faults,
+	   throughput.failures);
+
+  }
+
+  return 0;
+
+} // main ()
+// ==============================================================================